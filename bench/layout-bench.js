@@ -0,0 +1,121 @@
+// Compares the node layouts the compact dawg serializer can write. For each
+// layout this times lookups of the test words in random order, and replays
+// the same lookups against a simulated 32KB, 8-way set-associative cache
+// with 64-byte lines to report the fraction of cache lines touched that miss.
+var request = require('request');
+var queue = require('queue-async');
+var zlib = require('zlib');
+
+var jsdawg = require("../index");
+
+var LINE_SIZE = 64;
+var CACHE_SETS = 64;
+var CACHE_WAYS = 8;
+
+function SimulatedCache() {
+    this.sets = [];
+    for (var i = 0; i < CACHE_SETS; i++) this.sets.push([]);
+    this.accesses = 0;
+    this.misses = 0;
+}
+
+SimulatedCache.prototype.touch = function(start, end) {
+    for (var line = Math.floor(start / LINE_SIZE); line <= Math.floor((end - 1) / LINE_SIZE); line++) {
+        var set = this.sets[line % CACHE_SETS];
+        var way = set.indexOf(line);
+        this.accesses++;
+        if (way == -1) {
+            this.misses++;
+            if (set.length == CACHE_WAYS) set.pop();
+        } else {
+            set.splice(way, 1);
+        }
+        // most recently used first
+        set.unshift(line);
+    }
+}
+
+// replays an exact lookup, touching each node the search reads
+function simulateLookup(buf, cache, word) {
+    var version = buf[4];
+    var nodeSize = buf[6];
+    var key = Buffer.from(word);
+    var node = 16;
+    for (var i = 0; i < key.length; i++) {
+        var edgeCount = buf[node];
+        cache.touch(node, node + nodeSize + 5 * edgeCount);
+
+        var child = -1;
+        for (var e = 0; e < edgeCount; e++) {
+            var letter = version == 2 ? buf[node + nodeSize + e] : buf[node + nodeSize + 5 * e];
+            if (letter == key[i]) {
+                var offsetAt = version == 2 ? node + nodeSize + edgeCount + 4 * e : node + nodeSize + 5 * e + 1;
+                child = buf.readUInt32LE(offsetAt) & 0x7fffffff;
+                break;
+            }
+        }
+        if (child == -1 || (child == 0 && nodeSize == 1)) return;
+        node = 16 + child;
+    }
+}
+
+function shuffle(list) {
+    var seed = 1;
+    for (var i = list.length - 1; i > 0; i--) {
+        seed = (seed * 16807) % 2147483647;
+        var j = seed % (i + 1);
+        var tmp = list[i];
+        list[i] = list[j];
+        list[j] = tmp;
+    }
+    return list;
+}
+
+var q = queue(1);
+var resp, dawg, words;
+q.defer(function(callback) {
+    request.get({url: "http://mapbox.s3.amazonaws.com/apendleton/test_words.txt.gz", encoding: null}, function(err, response, body) {
+        if (err) throw "S3 fetch failed";
+        zlib.gunzip(body, function(err, data) {
+            if (err) throw ("Zlib decompression failed: " + err);
+            resp = data.toString();
+            callback();
+        })
+    })
+});
+
+q.defer(function(callback) {
+    words = resp.trim().split("\n");
+
+    dawg = new jsdawg.Dawg();
+    for (var i = 0; i < words.length; i++) {
+        dawg.insert(words[i]);
+    }
+    dawg.finish();
+    words = shuffle(words.slice());
+
+    callback();
+});
+
+q.defer(function(callback) {
+    Object.keys(jsdawg.LAYOUTS).forEach(function(name) {
+        var buf = dawg.toCompactDawgBuffer(false, 1, jsdawg.LAYOUTS[name]);
+        var compactDawg = new jsdawg.CompactDawg(buf);
+
+        console.time(name + " search");
+        for (var j = 0; j < 20; j++) {
+            for (var i = 0; i < words.length; i++) {
+                compactDawg.lookup(words[i]);
+            }
+        }
+        console.timeEnd(name + " search");
+
+        var cache = new SimulatedCache();
+        for (var i = 0; i < words.length; i++) {
+            simulateLookup(buf, cache, words[i]);
+        }
+        console.log(name + " simulated miss rate: " + (100 * cache.misses / cache.accesses).toFixed(2) + "% of " + cache.accesses + " line accesses");
+    });
+
+    callback();
+});
@@ -4,7 +4,8 @@
     {
       "target_name": "jsdawg",
       "sources": [
-        "src/binding.cpp"
+        "src/binding.cpp",
+        "src/compact_dawg.cpp"
       ],
       'include_dirs': [
         '<!(node -e \'require("nan")\')'
@@ -2,35 +2,114 @@ var binding = require("./lib/binding/jsdawg.node");
 var assert = require("assert");
 var Symbol = require("es6-symbol");
 
-function validate(buf) {
-    // validate data
+function validateHeader(buf) {
+    // validate everything but the checksum, which requires reading the
+    // whole structure
+    assert(buf.length >= 16, "dawg is too short to contain a header");
     var magic = buf.slice(0, 4).toString();
     var version = buf[4];
     var charWidth = buf[5];
     var nodeWidth = buf[6];
     var offsetWidth = buf[7];
     var size = buf.readUInt32LE(8);
-    var checksum = buf.readUInt32LE(12);
 
-    var structure = buf.slice(16);
-    var actualSize = structure.length;
-    var actualChecksum = binding.crc32c(structure);
+    var actualSize = buf.length - 16;
 
     assert(magic == "dawg", "dawg magic phrase is incorrect");
-    assert(version == 1, "dawg version should be 1");
+    assert(version >= 1 && version <= 4, "dawg version should be between 1 and 4");
     assert(charWidth == 1, "only dawgs with one-byte chars are supported");
-    assert(nodeWidth == 1 || nodeWidth == 5, "only dawgs with one- or five-byte edge count widths are supported");
-    assert(offsetWidth == 4, "only dawgs with four-byte offset widths are supported");
+    assert(nodeWidth == 1 || nodeWidth == 5 || nodeWidth == 9, "only dawgs with one-, five- or nine-byte node widths are supported");
+    if (version >= 3) {
+        assert(offsetWidth >= 2 && offsetWidth <= 4, "only dawgs with two- to four-byte offset widths are supported");
+    } else {
+        assert(offsetWidth == 4, "only dawgs with four-byte offset widths are supported");
+    }
     assert(size == actualSize, "dawg size is not as expected");
+    return buf;
+}
+
+function validate(buf) {
+    // validate data
+    validateHeader(buf);
+    var checksum = buf.readUInt32LE(12);
+
+    var structure = buf.slice(16);
+    var actualChecksum = binding.crc32c(structure);
+
     assert(checksum == actualChecksum, "dawg checksum is not correct");
     return buf;
 }
 
 var EDGE_COUNT_ONLY = 1,
-    INCLUDES_ENTRY_COUNT = 5;
+    INCLUDES_ENTRY_COUNT = 5,
+    INCLUDES_EDGE_RANKS = 9;
+
+// As CompactDawg#prefixesOf, but without indexes.
+binding.Dawg.prototype.prefixesOf = function(key) {
+    var lengths = this._prefixesOf(key);
+    var bytes = Buffer.from(key);
+    return lengths.map(function(length) {
+        return {text: bytes.slice(0, length).toString(), length: length};
+    });
+}
+
+binding.Dawg.prototype.longestPrefixOf = function(key) {
+    var prefixes = this.prefixesOf(key);
+    return prefixes.length ? prefixes[prefixes.length - 1] : null;
+}
+
+// version 2 stores each node's letters contiguously, which speeds up
+// lookups on nodes with many edges; version 3 does the same but shrinks the
+// dawg by using varint counts and the narrowest offsets that fit, at some
+// cost in lookup speed; version 4 additionally stores chains of single-child
+// nodes as inline strings, which suits long keys; version 1 is the default
+// for compatibility with older readers. `layout` picks the order nodes are
+// written in (see LAYOUTS); it doesn't affect the format. `ranks` keeps
+// counts along with a rank per edge, which makes counted and inverse lookups
+// faster on nodes with many edges at the cost of four bytes per edge.
+binding.Dawg.prototype.toCompactDawg = function(preserveCounts, version, layout, ranks) {
+    return new binding.CompactDawg(validate(this.toCompactDawgBuffer(preserveCounts, version, layout, ranks)));
+}
+
+// keep in sync with the DAWG_LAYOUT_* constants in builder.cpp. 'hybrid'
+// writes the nodes near the root breadth-first, which makes lookups in large
+// dawgs touch fewer cache lines; 'depthFirst' is the default and matches
+// what older versions wrote.
+var LAYOUTS = {depthFirst: 0, hybrid: 1};
 
-binding.Dawg.prototype.toCompactDawg = function(preserveCounts) {
-    return new binding.CompactDawg(validate(this.toCompactDawgBuffer(preserveCounts)));
+// Memory-maps a compact dawg file instead of reading it into the heap. The
+// `verify` option controls the checksum check: 'eager' (the default) runs
+// it before returning, 'lazy' runs it on the threadpool and exposes the
+// outcome as the `verified` promise on the returned dawg, and 'none' skips
+// it. A failed lazy check is only reported to callers that chain on
+// `verified`: the promise has a no-op handler of its own, so ignoring it
+// doesn't leave an unhandled rejection behind. The header is always
+// checked. The mapping is read-only, so the underlying buffer must not be
+// written to.
+binding.CompactDawg.fromFile = function(path, options) {
+    var verify = (options && options.verify) || 'eager';
+    assert(verify == 'eager' || verify == 'lazy' || verify == 'none', "verify must be one of 'eager', 'lazy' or 'none'");
+
+    var buf = binding.mapFile(path);
+    if (verify == 'eager') {
+        validate(buf);
+    } else {
+        validateHeader(buf);
+    }
+
+    var compactDawg = new binding.CompactDawg(buf);
+    if (verify == 'lazy') {
+        var checksum = buf.readUInt32LE(12);
+        compactDawg.verified = new Promise(function(resolve, reject) {
+            binding.crc32cAsync(buf.slice(16), function(err, actualChecksum) {
+                if (err) return reject(err);
+                if (checksum != actualChecksum) return reject(new Error("dawg checksum is not correct"));
+                resolve(compactDawg);
+            });
+        });
+        compactDawg.verified.catch(function() {});
+    }
+    return compactDawg;
 }
 
 binding.CompactDawg.prototype.lookupPrefix = function(prefix) {
@@ -60,7 +139,111 @@ binding.CompactDawg.prototype.lookupCounts = function(prefix) {
     }
 }
 
+// Finds the words within `maxEdits` insertions, deletions or substitutions
+// of a key (counted in bytes of utf8) in a single walk over the dawg.
+// Returns an array of {text, distance, index}, closest first and then in
+// order; index is only set on dawgs with counts. With `prefix`, words match
+// if any prefix of them does, for fuzzy autocompletion. `limit` caps how
+// many matches are returned, which also lets the search stop early.
+binding.CompactDawg.prototype.fuzzyLookup = function(key, maxEdits, options) {
+    assert(typeof key == 'string', "key must be a String");
+    assert(maxEdits >>> 0 === maxEdits, "maxEdits must be a non-negative integer");
+    var limit = (options && options.limit) || 0;
+    var flat = this._fuzzyLookup(key, maxEdits, !!(options && options.prefix), limit);
+    var out = [];
+    for (var i = 0; i < flat.length; i += 3) {
+        var match = {text: flat[i], distance: flat[i + 1]};
+        if (flat[i + 2] != -1) match.index = flat[i + 2];
+        out.push(match);
+    }
+    return out;
+}
+
+// Returns the `limit` best-scoring words that start with `prefix`, as
+// {text, index, score}, best first and then in order. Needs a score table
+// attached with setScores; the search only reads the nodes on the way to
+// the results and their siblings, however many words share the prefix.
+binding.CompactDawg.prototype.complete = function(prefix, limit) {
+    assert(typeof prefix == 'string', "prefix must be a String");
+    assert(limit >>> 0 === limit, "limit must be a non-negative integer");
+    var flat = this._complete(prefix, limit);
+    var out = [];
+    for (var i = 0; i < flat.length; i += 3) {
+        out.push({text: flat[i], index: flat[i + 1], score: flat[i + 2]});
+    }
+    return out;
+}
+
+// Returns the prefixes of `key` that are words, shortest first, as {text,
+// length, index}: length is in bytes of utf8, and index is only set on
+// dawgs with counts. Walks the key's path once, however many prefixes
+// there are.
+binding.CompactDawg.prototype.prefixesOf = function(key) {
+    var flat = this._prefixesOf(key);
+    var bytes = Buffer.from(key);
+    var out = [];
+    for (var i = 0; i < flat.length; i += 2) {
+        var match = {text: bytes.slice(0, flat[i]).toString(), length: flat[i]};
+        if (flat[i + 1] != -1) match.index = flat[i + 1];
+        out.push(match);
+    }
+    return out;
+}
+
+// Returns the longest prefix of `key` that is a word, as in prefixesOf, or
+// null if there isn't one.
+binding.CompactDawg.prototype.longestPrefixOf = function(key) {
+    var prefixes = this.prefixesOf(key);
+    return prefixes.length ? prefixes[prefixes.length - 1] : null;
+}
+
+// keep in sync with the LOOKUP_MANY_* constants in binding.cpp
+var LOOKUP_MANY_MODES = {exact: 0, prefix: 1, counts: 2};
+
+// Looks up an array of strings, or a buffer of newline-delimited keys, in a
+// single call. Returns a Uint8Array of 0/1 flags for 'exact' (the default)
+// and 'prefix' modes, and an Int32Array of indexes, with -1 for keys that
+// aren't in the dawg, for 'counts' mode.
+binding.CompactDawg.prototype.lookupMany = function(keys, options) {
+    var mode = (options && options.mode) || 'exact';
+    assert(LOOKUP_MANY_MODES.hasOwnProperty(mode), "mode must be one of 'exact', 'prefix' or 'counts'");
+    return this._lookupMany(keys, LOOKUP_MANY_MODES[mode]);
+}
+
+// A CompactDawgSet holds up to 32 compact dawg buffers and looks keys up
+// in all of them in one call, walking them side by side. lookup and
+// lookupPrefix return a mask with bit i set if the i-th dawg has the key
+// (as a word, or as a prefix of one); lookupMany takes keys as
+// CompactDawg#lookupMany does, in 'exact' or 'prefix' mode, and returns a
+// Uint32Array of masks.
+binding.CompactDawgSet.prototype.lookup = function(key) {
+    return this._lookup(key, LOOKUP_MANY_MODES.exact);
+}
+
+binding.CompactDawgSet.prototype.lookupPrefix = function(prefix) {
+    return this._lookup(prefix, LOOKUP_MANY_MODES.prefix);
+}
+
+binding.CompactDawgSet.prototype.lookupMany = function(keys, options) {
+    var mode = (options && options.mode) || 'exact';
+    assert(mode == 'exact' || mode == 'prefix', "mode must be one of 'exact' or 'prefix'");
+    return this._lookupMany(keys, LOOKUP_MANY_MODES[mode]);
+}
+
+// how many words a ranged iterator fetches from the binding at a time
+var RANGE_CHUNK_SIZE = 256;
+
+// Called with a prefix, iterates over the words that start with it. Called
+// with {from, to, limit} on a dawg with counts, iterates over the words from
+// index `from` up to, but not including, index `to`, stopping after `limit`
+// words; `from` and `to` can also be keys, which stand for the index of the
+// first word at or after them. The start is found with the counts rather
+// than by walking the words before it.
 binding.CompactDawg.prototype.iterator = function(prefix) {
+    if (prefix && typeof prefix == 'object') {
+        return rangeIterator(this, prefix);
+    }
+
     // implement the ES6 iterator pattern
     var it = prefix ? this._iterator(prefix) : this._iterator();
     return {
@@ -74,13 +257,363 @@ binding.CompactDawg.prototype.iterator = function(prefix) {
             function() {
                 var n = it.next();
                 return {value: n, done: n === undefined};
-            }
+            },
+        nextBatch: function(size) { return it.nextBatch(size); },
+        toBuffer: function() { return it.toBuffer(); }
     }
 }
 
 binding.CompactDawg.prototype[Symbol.iterator] = binding.CompactDawg.prototype.iterator;
 
+// Besides next(), the iterators have nextBatch(size), which returns a Buffer
+// of up to `size` words each followed by a newline (or undefined once they
+// run out), and toBuffer(), which returns all the words left that way. Both
+// are much faster than next() for dumping many words. Unlike next(), the
+// words they return include the prefix being iterated over.
+
+function rangeIterator(compactDawg, options) {
+    function toIndex(bound, fallback) {
+        if (bound === undefined) return fallback;
+        return typeof bound == 'string' ? compactDawg._lowerBound(bound) : bound;
+    }
+    var from = toIndex(options.from, 0);
+    var to = toIndex(options.to, Infinity);
+    var limit = options.limit === undefined ? Infinity : options.limit;
+    var count = Math.min(Math.max(0, Math.min(to - from, limit)), 0xffffffff);
+
+    var it = compactDawg._rangeIterator(from, count);
+    var chunk = [], position = 0;
+    return {
+        next: function() {
+            if (position == chunk.length) {
+                chunk = it.nextChunk(RANGE_CHUNK_SIZE);
+                position = 0;
+            }
+            return position < chunk.length ? {value: chunk[position++], done: false} : {value: undefined, done: true};
+        },
+        nextBatch: function(size) {
+            // words already fetched for next() come first
+            if (position < chunk.length) {
+                var fetched = chunk.slice(position, position + size);
+                position += fetched.length;
+                var head = Buffer.from(fetched.join("\n") + "\n");
+                var rest = fetched.length < size ? it.nextBatch(size - fetched.length) : undefined;
+                return rest ? Buffer.concat([head, rest]) : head;
+            }
+            return it.nextBatch(size);
+        },
+        toBuffer: function() {
+            var fetched = chunk.slice(position);
+            position = chunk.length;
+            var rest = it.toBuffer();
+            return fetched.length ? Buffer.concat([Buffer.from(fetched.join("\n") + "\n"), rest]) : rest;
+        }
+    }
+}
+
+// how many bytes of words an unsorted build sorts in memory at a time
+var DEFAULT_SORT_MEMORY = 256 * 1024 * 1024;
+
+// Builds a compact dawg from a file of sorted, newline-delimited words on the
+// threadpool instead of inserting them one by one on the main thread. Empty
+// lines are skipped and other lines are used as is. `counts`, `version`,
+// `layout` (a LAYOUTS value) and `ranks` are as in toCompactDawg; `threads`
+// (default 1) splits the words into shards by their first byte and builds
+// them on that many threads, which needs the whole file in memory but gives
+// the same dawg. With `unsorted` the lines may come in any order and repeat:
+// they're sorted in runs of up to `sortMemory` bytes (default 256MB), spilled
+// to temporary files and merged into the dawg, in which case `threads` is
+// ignored. The temporary files go in `tempDir`, or $TMPDIR if it isn't
+// given, falling back to /tmp; for large inputs pick a directory on a disk
+// with room for a copy of the file, since /tmp is often small or in memory.
+// Resolves with the compact dawg buffer.
+function buildCompactDawgFromFile(path, options) {
+    return build(path, null, options);
+}
+
+// Like buildCompactDawgFromFile, but streams the compact dawg to `outPath` as
+// it's serialized rather than holding it all in memory. Resolves once the
+// file has been written; its header is filled in last, so a build that dies
+// part way through leaves a file that fails validation.
+function buildCompactDawgFile(inPath, outPath, options) {
+    assert(typeof outPath == 'string' && outPath.length > 0, "outPath must be a non-empty string");
+    return build(inPath, outPath, options);
+}
+
+function build(inPath, outPath, options) {
+    var nodeSize = EDGE_COUNT_ONLY;
+    if (options && options.ranks) nodeSize = INCLUDES_EDGE_RANKS;
+    else if (options && options.counts) nodeSize = INCLUDES_ENTRY_COUNT;
+    var version = (options && options.version) || 1;
+    var layout = (options && options.layout) || LAYOUTS.depthFirst;
+    var threads = (options && options.threads) || 1;
+    var sortMemory = 0;
+    if (options && options.unsorted) sortMemory = options.sortMemory || DEFAULT_SORT_MEMORY;
+    var tempDir = (options && options.tempDir) || null;
+    return new Promise(function(resolve, reject) {
+        binding.buildCompactDawgFromFile(inPath, nodeSize, version, layout, threads, sortMemory, tempDir, outPath, function(err, buf) {
+            if (err) return reject(err);
+            resolve(buf);
+        });
+    });
+}
+
+// Builds a score table for a counted compact dawg's completions from a
+// score for each of its words, by index, as a Uint32Array or an Array of
+// unsigned integers. The table is a Buffer, so it can be saved alongside
+// the dawg and memory-mapped later; attach it with CompactDawg#setScores.
+function buildScoreTable(scores) {
+    return binding.buildScoreTable(scores instanceof Uint32Array ? scores : Uint32Array.from(scores));
+}
+
+// Orders strings the way dawgs do, by their utf8 bytes. That's code point
+// order, which only differs from comparing code units for characters past
+// U+FFFF (stored as surrogates) against those from U+E000 up.
+function compareUtf8(a, b) {
+    var length = Math.min(a.length, b.length);
+    for (var i = 0; i < length; i++) {
+        var x = a.charCodeAt(i), y = b.charCodeAt(i);
+        if (x != y) {
+            if (x >= 0xd800 && y >= 0xd800) {
+                x = x >= 0xe000 ? x - 0x800 : x + 0x2000;
+                y = y >= 0xe000 ? y - 0x800 : y + 0x2000;
+            }
+            return x - y;
+        }
+    }
+    return a.length - b.length;
+}
+
+// the index of the first of some sorted words that doesn't sort before `word`
+function lowerBound(words, word) {
+    var lo = 0, hi = words.length;
+    while (lo < hi) {
+        var mid = (lo + hi) >>> 1;
+        if (compareUtf8(words[mid], word) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+function contains(words, word) {
+    var i = lowerBound(words, word);
+    return i < words.length && words[i] === word;
+}
+
+// the range of some sorted words that start with `prefix`, which sort
+// together
+function prefixRange(words, prefix) {
+    var start = lowerBound(words, prefix);
+    var lo = start, hi = words.length;
+    while (lo < hi) {
+        var mid = (lo + hi) >>> 1;
+        if (words[mid].startsWith(prefix)) lo = mid + 1;
+        else hi = mid;
+    }
+    return [start, lo];
+}
+
+// A compact dawg (given as its buffer) with a small, mutable set of words
+// added and removed on top. Lookups, prefix lookups, iteration and (on
+// dawgs with counts) counted lookups see the combined words, as if the
+// dawg had been rebuilt with the changes. Once `compactThreshold` changes
+// have piled up (if set), they're folded into a new compact buffer on the
+// threadpool, which replaces the base; `onCompact(err, buf)` is called
+// with the outcome, e.g. to persist the new buffer. `layout` is the
+// LAYOUTS value compaction writes with.
+function DawgOverlay(buf, options) {
+    this.buffer = validateHeader(buf);
+    this.base = new binding.CompactDawg(buf);
+    this.counted = buf[6] != EDGE_COUNT_ONLY;
+    // sorted by compareUtf8; added words are never in the base, and
+    // deleted ones always are
+    this.added = [];
+    this.deleted = [];
+    this.compactThreshold = (options && options.compactThreshold) || 0;
+    this.layout = (options && options.layout) || LAYOUTS.depthFirst;
+    this.onCompact = options && options.onCompact;
+    this.compacting = null;
+    this._counts = new Int32Array(3);
+}
+
+// Adds a word; returns false if it was already there.
+DawgOverlay.prototype.add = function(word) {
+    assert(typeof word == 'string' && word.length > 0, "word must be a non-empty String");
+    if (this.lookup(word)) return false;
+    var i = lowerBound(this.deleted, word);
+    if (i < this.deleted.length && this.deleted[i] === word) {
+        this.deleted.splice(i, 1);
+    } else {
+        this.added.splice(lowerBound(this.added, word), 0, word);
+    }
+    this._changed();
+    return true;
+}
+
+// Removes a word; returns false if it wasn't there.
+DawgOverlay.prototype.delete = function(word) {
+    assert(typeof word == 'string', "word must be a String");
+    if (!this.lookup(word)) return false;
+    var i = lowerBound(this.added, word);
+    if (i < this.added.length && this.added[i] === word) {
+        this.added.splice(i, 1);
+    } else {
+        this.deleted.splice(lowerBound(this.deleted, word), 0, word);
+    }
+    this._changed();
+    return true;
+}
+
+DawgOverlay.prototype.lookup = function(word) {
+    if (contains(this.added, word)) return true;
+    if (contains(this.deleted, word)) return false;
+    return this.base.lookup(word);
+}
+
+DawgOverlay.prototype.lookupPrefix = function(prefix) {
+    var added = prefixRange(this.added, prefix);
+    if (added[1] > added[0]) return true;
+    if (!this.base.lookupPrefix(prefix)) return false;
+
+    var deleted = prefixRange(this.deleted, prefix);
+    if (deleted[1] == deleted[0]) return true;
+    // the prefix is only left if some word with it wasn't deleted, and
+    // there are just so many that were
+    var it = this.base.iterator(prefix);
+    for (var i = 0; i <= deleted[1] - deleted[0]; i++) {
+        var n = it.next();
+        if (n.done) return false;
+        if (!contains(this.deleted, n.value)) return true;
+    }
+    return false;
+}
+
+// As CompactDawg#lookupCounts and lookupPrefixCounts, with indexes and
+// suffix counts into the combined words. Require a base with counts.
+DawgOverlay.prototype.lookupCounts = function(word) {
+    return this.lookup(word) ? this._counted(word) : {found: false};
+}
+
+DawgOverlay.prototype.lookupPrefixCounts = function(prefix) {
+    return this.lookupPrefix(prefix) ? this._counted(prefix) : {found: false};
+}
+
+// How many words there are. Requires a base with counts.
+DawgOverlay.prototype.size = function() {
+    return this._suffixCount('');
+}
+
+DawgOverlay.prototype._counted = function(prefix) {
+    assert(this.counted, "counts lookups require a dawg with embedded counts");
+    // deleted words are all in the base, so the ones sorting before the
+    // prefix are among the base words that do
+    var index = this.base._lowerBound(prefix) - lowerBound(this.deleted, prefix) + lowerBound(this.added, prefix);
+    return {found: true, index: index, suffixCount: this._suffixCount(prefix), text: prefix};
+}
+
+DawgOverlay.prototype._suffixCount = function(prefix) {
+    assert(this.counted, "counts lookups require a dawg with embedded counts");
+    this.base.lookupCountsInto(prefix, this._counts);
+    var added = prefixRange(this.added, prefix);
+    var deleted = prefixRange(this.deleted, prefix);
+    return this._counts[2] - (deleted[1] - deleted[0]) + (added[1] - added[0]);
+}
+
+// Iterates over the combined words in order, or over those that start with
+// a prefix, as CompactDawg#iterator does.
+DawgOverlay.prototype.iterator = function(prefix) {
+    prefix = prefix || '';
+    var base = prefix ? this.base.iterator(prefix) : this.base.iterator();
+    var addedRange = prefixRange(this.added, prefix);
+    var deletedRange = prefixRange(this.deleted, prefix);
+    var added = this.added.slice(addedRange[0], addedRange[1]);
+    var deleted = this.deleted.slice(deletedRange[0], deletedRange[1]);
+    var nextAdded = 0, nextDeleted = 0;
+
+    // the next base word that hasn't been deleted
+    function nextBase() {
+        for (var n = base.next(); !n.done; n = base.next()) {
+            while (nextDeleted < deleted.length && compareUtf8(deleted[nextDeleted], n.value) < 0) nextDeleted++;
+            if (nextDeleted == deleted.length || deleted[nextDeleted] !== n.value) return n.value;
+        }
+        return undefined;
+    }
+    var baseWord = nextBase();
+
+    return {
+        next: function() {
+            var word;
+            if (nextAdded < added.length && (baseWord === undefined || compareUtf8(added[nextAdded], baseWord) < 0)) {
+                word = added[nextAdded++];
+            } else if (baseWord !== undefined) {
+                word = baseWord;
+                baseWord = nextBase();
+            }
+            return {value: word, done: word === undefined};
+        }
+    }
+}
+
+DawgOverlay.prototype[Symbol.iterator] = DawgOverlay.prototype.iterator;
+
+// Folds the changes made so far into a new compact buffer, built on the
+// threadpool, and makes it the base; changes made in the meantime are kept
+// on top of it. Resolves with the new buffer. Only one compaction runs at a
+// time; calling this while one is running returns that one.
+DawgOverlay.prototype.compact = function() {
+    if (this.compacting) return this.compacting;
+
+    var overlay = this;
+    var added = this.added.slice(), deleted = this.deleted.slice();
+    this.compacting = new Promise(function(resolve, reject) {
+        binding.mergeCompactDawg(overlay.buffer, added, deleted, overlay.layout, function(err, buf) {
+            overlay.compacting = null;
+            if (err) return reject(err);
+            overlay._rebase(buf, added.concat(deleted));
+            resolve(buf);
+        });
+    });
+    return this.compacting;
+}
+
+// Swaps in a compacted base, working out which words still differ from it:
+// only words changed before or during the compaction can.
+DawgOverlay.prototype._rebase = function(buf, compacted) {
+    var base = new binding.CompactDawg(buf);
+    var touched = compacted.concat(this.added, this.deleted).sort(compareUtf8);
+    var added = [], deleted = [];
+    for (var i = 0; i < touched.length; i++) {
+        var word = touched[i];
+        if (i > 0 && word === touched[i - 1]) continue;
+        var present = this.lookup(word);
+        if (present && !base.lookup(word)) added.push(word);
+        else if (!present && base.lookup(word)) deleted.push(word);
+    }
+    this.buffer = buf;
+    this.base = base;
+    this.added = added;
+    this.deleted = deleted;
+}
+
+DawgOverlay.prototype._changed = function() {
+    if (!this.compactThreshold || this.compacting) return;
+    if (this.added.length + this.deleted.length < this.compactThreshold) return;
+
+    var onCompact = this.onCompact;
+    this.compact().then(function(buf) {
+        if (onCompact) onCompact(null, buf);
+    }, function(err) {
+        if (onCompact) onCompact(err);
+    });
+}
+
 module.exports = {
     Dawg: binding.Dawg,
-    CompactDawg: binding.CompactDawg
+    CompactDawg: binding.CompactDawg,
+    CompactDawgSet: binding.CompactDawgSet,
+    LAYOUTS: LAYOUTS,
+    buildCompactDawgFromFile: buildCompactDawgFromFile,
+    buildCompactDawgFile: buildCompactDawgFile,
+    buildScoreTable: buildScoreTable,
+    DawgOverlay: DawgOverlay
 };
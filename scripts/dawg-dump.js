@@ -3,19 +3,37 @@
 var jsdawg = require("../index");
 var minimist = require("minimist");
 var fs = require("fs");
-var forOf = require("es6-iterator/for-of");
 
 var argv = require('minimist')(process.argv.slice(2));
 
-var input = (argv._.length == 0 || argv._[0] == "-") ? process.stdin : fs.createReadStream(argv._[0]);
 var output = (argv._.length < 2 || argv._[1] == "-") ? process.stdout : fs.createWriteStream(argv._[1]);
 
-var chunks = [];
-input.on('data', function(chunk) { chunks.push(chunk); });
-input.on('end', function() {
-    var data = Buffer.concat(chunks);
-    var compactDawg = new jsdawg.CompactDawg(data);
-    forOf(compactDawg, function(value) {
-        console.log(value);
-    })
-});
\ No newline at end of file
+// words per write
+var BATCH_SIZE = 65536;
+
+function dump(compactDawg) {
+    var it = compactDawg.iterator();
+    function writeBatches() {
+        for (var batch = it.nextBatch(BATCH_SIZE); batch !== undefined; batch = it.nextBatch(BATCH_SIZE)) {
+            if (!output.write(batch)) {
+                // let the output flush before walking any further, so at
+                // most a batch or so is ever buffered
+                output.once('drain', writeBatches);
+                return;
+            }
+        }
+        if (output !== process.stdout) output.end();
+    }
+    writeBatches();
+}
+
+if (argv._.length == 0 || argv._[0] == "-") {
+    var chunks = [];
+    process.stdin.on('data', function(chunk) { chunks.push(chunk); });
+    process.stdin.on('end', function() {
+        var data = Buffer.concat(chunks);
+        dump(new jsdawg.CompactDawg(data));
+    });
+} else {
+    dump(jsdawg.CompactDawg.fromFile(argv._[0]));
+}
\ No newline at end of file
@@ -1,6 +1,14 @@
 #include "builder.cpp"
+#include "compact_dawg.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
 #include <nan.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using v8::FunctionTemplate;
 using v8::Handle;
@@ -15,20 +23,9 @@ void free_dawg_vector(char* /*data*/, void* hint) {
     delete reinterpret_cast<std::vector<unsigned char>*>(hint);
 }
 
-struct node_position {
-    unsigned int node_offset;
-    unsigned int edge_idx;
-    bool visited;
-    node_position(unsigned int off, unsigned int idx, bool v) : node_offset(off),
-                                                                edge_idx(idx),
-                                                                visited(v) {}
-    // non-copyable
-    node_position(node_position&&) noexcept = default;
-    node_position& operator=(node_position&&) noexcept = default; // NOLINT
-    ~node_position() noexcept = default;
-    node_position(node_position const&) = delete;
-    node_position& operator=(node_position const&) = delete;
-};
+void unmap_dawg_file(char* data, void* hint) {
+    munmap(data, reinterpret_cast<std::size_t>(hint));
+}
 
 class JSDawg : public Nan::ObjectWrap {
   public:
@@ -41,6 +38,7 @@ class JSDawg : public Nan::ObjectWrap {
         SetPrototypeMethod(tpl, "finish", Finish);
         SetPrototypeMethod(tpl, "lookup", Lookup);
         SetPrototypeMethod(tpl, "lookupPrefix", LookupPrefix);
+        SetPrototypeMethod(tpl, "_prefixesOf", PrefixesOf);
         SetPrototypeMethod(tpl, "edgeCount", EdgeCount);
         SetPrototypeMethod(tpl, "nodeCount", NodeCount);
         SetPrototypeMethod(tpl, "toCompactDawgBuffer", ToCompactDawgBuffer);
@@ -110,6 +108,22 @@ class JSDawg : public Nan::ObjectWrap {
         info.GetReturnValue().Set(found);
     }
 
+    // Returns the byte lengths of the prefixes of a key that are words.
+    static NAN_METHOD(PrefixesOf) {
+        if (!info[0]->IsString()) {
+            return Nan::ThrowTypeError("first argument must be a String");
+        }
+        auto* obj = Nan::ObjectWrap::Unwrap<JSDawg>(info.This());
+        String::Utf8Value utf8_value(info[0].As<String>());
+        std::vector<std::size_t> lengths = obj->dawg_.prefixes_of(*utf8_value, utf8_value.length());
+
+        v8::Local<v8::Array> out = Nan::New<v8::Array>(static_cast<int>(lengths.size()));
+        for (std::size_t i = 0; i < lengths.size(); i++) {
+            Nan::Set(out, static_cast<uint32_t>(i), Nan::New(static_cast<uint32_t>(lengths[i])));
+        }
+        info.GetReturnValue().Set(out);
+    }
+
     static NAN_METHOD(EdgeCount) {
         auto* obj = Nan::ObjectWrap::Unwrap<JSDawg>(info.This());
         info.GetReturnValue().Set(obj->dawg_.edge_count());
@@ -128,8 +142,37 @@ class JSDawg : public Nan::ObjectWrap {
             preserveCounts = info[0]->BooleanValue();
         }
 
+        // edge ranks speed up counted and inverse lookups, and imply counts
+        bool ranks = false;
+        if (info.Length() > 3) {
+            ranks = info[3]->BooleanValue();
+        }
+
+        unsigned int version = DAWG_VERSION_INTERLEAVED_EDGES;
+        if (info.Length() > 1 && !info[1]->IsUndefined()) {
+            if (!info[1]->IsUint32()) {
+                return Nan::ThrowTypeError("version must be a Number");
+            }
+            version = info[1]->Uint32Value();
+            if (!supported_dawg_version(version)) {
+                return Nan::ThrowError("unsupported dawg version");
+            }
+        }
+
+        unsigned int layout = DAWG_LAYOUT_DEPTH_FIRST;
+        if (info.Length() > 2 && !info[2]->IsUndefined()) {
+            if (!info[2]->IsUint32()) {
+                return Nan::ThrowTypeError("layout must be a Number");
+            }
+            layout = info[2]->Uint32Value();
+            if (layout != DAWG_LAYOUT_DEPTH_FIRST && layout != DAWG_LAYOUT_HYBRID) {
+                return Nan::ThrowError("unsupported dawg layout");
+            }
+        }
+
         auto* output = new std::vector<unsigned char>();
-        build_compact_dawg(&(obj->dawg_), output, false, preserveCounts ? INCLUDES_ENTRY_COUNT : EDGE_COUNT_ONLY);
+        unsigned int node_size = ranks ? INCLUDES_EDGE_RANKS : (preserveCounts ? INCLUDES_ENTRY_COUNT : EDGE_COUNT_ONLY);
+        build_compact_dawg(&(obj->dawg_), output, false, node_size, version, layout);
 
         Nan::MaybeLocal<v8::Object> out = Nan::NewBuffer(
             reinterpret_cast<char*>(&((*output)[0])),
@@ -145,219 +188,60 @@ class JSDawg : public Nan::ObjectWrap {
     }
 };
 
-struct dawg_search_result {
-    std::unique_ptr<std::string> match_string = nullptr;
-    int node_offset = -1;
-    bool found = false;
-    bool final = false;
-    int skipped = -1;
-    int child_count = -1;
-};
-
-dawg_search_result compact_dawg_search(unsigned char* data, const unsigned char* search, size_t search_length, unsigned int node_size) {
-    unsigned int flagged_offset, node_final = 0;
-    bool match = false;
-    int node_offset = 0, edge_count = 0, edge_offset = 0, min = 0, max = 0, guess = 0;
-    unsigned char search_letter, letter;
-
-    dawg_search_result output;
-
-    for (size_t i = 0; i < search_length; i++) {
-        // binary search over the node edges
-        match = false; // NOLINT (clang tidy thinks it is not used but it is)
-        search_letter = search[i];
-
-        if (node_offset != -1) {
-            edge_count = static_cast<int>(data[node_offset]);
-
-            if (edge_count > 0) {
-                min = 0;
-                max = edge_count - 1;
-
-                while (min <= max) {
-                    guess = (min + max) >> 1;
-                    edge_offset = node_offset + node_size + (5 * guess);
-                    letter = data[edge_offset];
-                    if (letter == search_letter) {
-                        match = true;
-                        break;
-                    }
-
-                    if (letter < search_letter) {
-                        min = guess + 1;
-                    } else {
-                        max = guess - 1;
-                    }
-                }
-            }
-        }
-        if (match) {
-            memcpy(&flagged_offset, &(data[edge_offset + 1]), sizeof(unsigned int));
-
-            node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
-            node_final = flagged_offset & IS_FINAL_FLAG;
-
-            if (node_offset == 0) {
-                node_offset = -1;
-            }
-        } else {
-            return output;
-        }
-    }
-
-    output.node_offset = node_offset;
-    output.found = true;
-    output.final = (node_final != 0u);
-    output.skipped = -1;
-    output.child_count = -1;
-    output.match_string = nullptr;
-    return output;
-}
-
-dawg_search_result counted_compact_dawg_search(unsigned char* data, const unsigned char* search, size_t search_length, unsigned int node_size) {
-    unsigned int flagged_offset, node_final = 0, tmp_final = 0;
-    int node_offset = 0, tmp_offset = 0, skipped = 0, skip_count = 0, edge_count = 0, edge_offset = 0;
-    bool match = false;
-    unsigned char search_letter, letter;
-
-    dawg_search_result output;
-
-    for (size_t i = 0; i < search_length; i++) {
-        // binary search over the node edges
-        match = false; // NOLINT (clang tidy thinks it is not used but it is)
-        search_letter = search[i];
-
-        if (node_offset != -1) {
-            edge_count = static_cast<int>(data[node_offset]);
-
-            if (edge_count > 0) {
-                for (int guess = 0; guess < edge_count; guess++) {
-                    edge_offset = node_offset + node_size + (5 * guess);
-                    letter = data[edge_offset];
-                    if (letter == search_letter) {
-                        match = true;
-                        break;
-                    }
-
-                    // peek into the node we didn't end up taking to determine the skip count
-                    memcpy(&flagged_offset, &(data[edge_offset + 1]), sizeof(unsigned int));
-
-                    tmp_offset = static_cast<int>(flagged_offset & FINAL_MASK);
-                    tmp_final = flagged_offset & IS_FINAL_FLAG;
+constexpr std::size_t arena_size = 1024;
 
-                    if (tmp_offset == 0 || static_cast<int>(data[tmp_offset]) == 0) {
-                        if (tmp_final != 0u) {
-                            skipped += 1;
-                        }
-                    } else {
-                        memcpy(&skip_count, &(data[tmp_offset + 1]), sizeof(int32_t));
-                        skipped += skip_count;
-                    }
-                }
-            }
+// modes for CompactDawg::LookupMany; keep in sync with index.js
+constexpr unsigned int LOOKUP_MANY_EXACT = 0;
+constexpr unsigned int LOOKUP_MANY_PREFIX = 1;
+constexpr unsigned int LOOKUP_MANY_COUNTS = 2;
+
+// Reads an Array of Strings, or a Buffer of newline-delimited keys, into
+// offsets relative to *base. String keys are copied into `arena` as utf8;
+// buffer keys are used in place. Throws and returns false on bad input.
+bool read_search_keys(v8::Local<v8::Value> input, std::vector<search_key>* keys, std::string* arena, const unsigned char** base) {
+    keys->clear();
+    arena->clear();
+    if (node::Buffer::HasInstance(input)) {
+        v8::Local<v8::Object> buf = input->ToObject();
+        const char* bytes = node::Buffer::Data(buf);
+        std::size_t length = node::Buffer::Length(buf);
+        std::size_t start = 0;
+        while (start < length) {
+            const void* newline = memchr(bytes + start, '\n', length - start);
+            std::size_t end = newline != nullptr ? static_cast<std::size_t>(static_cast<const char*>(newline) - bytes) : length;
+            keys->push_back({start, end - start});
+            start = end + 1;
         }
-        if (match) {
-            memcpy(&flagged_offset, &(data[edge_offset + 1]), sizeof(unsigned int));
-
-            node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
-            node_final = flagged_offset & IS_FINAL_FLAG;
-
-            if (node_offset > 0) {
-                memcpy(&skip_count, &(data[node_offset + 1]), sizeof(int32_t));
-            } else {
-                skip_count = 0;
-            }
-            if (node_final != 0u) {
-                skipped += 1;
+        *base = reinterpret_cast<const unsigned char*>(bytes);
+    } else if (input->IsArray()) {
+        v8::Local<v8::Array> list = input.As<v8::Array>();
+        uint32_t length = list->Length();
+        keys->reserve(length);
+
+        const int flags = v8::String::NO_NULL_TERMINATION | v8::String::REPLACE_INVALID_UTF8;
+        for (uint32_t i = 0; i < length; i++) {
+            v8::Local<v8::Value> js_val = Nan::Get(list, i).ToLocalChecked();
+            if (!js_val->IsString()) {
+                Nan::ThrowTypeError("keys must be Strings");
+                return false;
             }
-
-            if (node_offset == 0) {
-                node_offset = -1;
-            }
-        } else {
-            return output;
-        }
-    }
-
-    output.node_offset = node_offset;
-    output.found = true;
-    output.final = (node_final != 0u);
-    output.child_count = skip_count;
-    output.skipped = node_final != 0u ? skipped - 1 : skipped;
-    output.match_string = nullptr;
-    return output;
-}
-
-dawg_search_result inverse_compact_dawg_search(unsigned char* data, int index, unsigned int node_size) {
-    unsigned int flagged_offset, node_final = 0;
-    int node_offset = 0, tmp_offset = 0, skip_count = 0, edge_count = 0, edge_offset = 0;
-    bool match = false;
-    unsigned char letter;
-    std::string match_string;
-
-    dawg_search_result output;
-    int remaining = index + 1;
-
-    while (true) {
-        match = false; // NOLINT (clang tidy thinks it is not used but it is)
-
-        if (node_offset != -1) {
-            edge_count = static_cast<int>(data[node_offset]);
-
-            if (edge_count > 0) {
-                for (int guess = 0; guess < edge_count; guess++) {
-                    edge_offset = node_offset + node_size + (5 * guess);
-                    letter = data[edge_offset];
-
-                    // peek into the node we didn't end up taking to determine the skip count
-                    memcpy(&flagged_offset, &(data[edge_offset + 1]), sizeof(unsigned int));
-
-                    tmp_offset = static_cast<int>(flagged_offset & FINAL_MASK);
-                    if (tmp_offset == 0 || static_cast<int>(data[tmp_offset]) == 0) {
-                        skip_count = 1;
-                    } else {
-                        memcpy(&skip_count, &(data[tmp_offset + 1]), sizeof(int32_t));
-                    }
-
-                    if (skip_count < remaining) {
-                        remaining -= skip_count;
-                        continue;
-                    }
-
-                    match_string += letter;
-                    break;
-                }
-            }
-        }
-        memcpy(&flagged_offset, &(data[edge_offset + 1]), sizeof(unsigned int));
-
-        node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
-        node_final = flagged_offset & IS_FINAL_FLAG;
-
-        if (node_final != 0u) {
-            remaining -= 1;
-        }
-
-        if (node_offset == 0) {
-            node_offset = -1;
-        }
-
-        if (remaining == 0 && (node_final != 0u)) {
-            break;
+            v8::Local<v8::String> js_str = js_val.As<v8::String>();
+            // as in Lookup, reserve the maximum possible utf8 length
+            std::size_t start = arena->size();
+            std::size_t max_length = 3 * static_cast<std::size_t>(js_str->Length());
+            arena->resize(start + max_length);
+            std::size_t utf8_length = js_str->WriteUtf8(&(*arena)[start], static_cast<int>(max_length), nullptr, flags);
+            arena->resize(start + utf8_length);
+            keys->push_back({start, utf8_length});
         }
+        *base = reinterpret_cast<const unsigned char*>(arena->data());
+    } else {
+        Nan::ThrowTypeError("first argument must be an Array of Strings or a Buffer");
+        return false;
     }
-
-    output.node_offset = node_offset;
-    output.found = true;
-    output.final = (node_final != 0u);
-    output.child_count = skip_count;
-    output.skipped = index;
-    output.match_string = std::make_unique<std::string>(match_string);
-    return output;
+    return true;
 }
 
-constexpr std::size_t arena_size = 1024;
-
 class CompactIterator : public Nan::ObjectWrap {
   public:
     static void Init(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
@@ -366,6 +250,9 @@ class CompactIterator : public Nan::ObjectWrap {
         tpl->InstanceTemplate()->SetInternalFieldCount(1);
 
         SetPrototypeMethod(tpl, "next", Next);
+        SetPrototypeMethod(tpl, "nextChunk", NextChunk);
+        SetPrototypeMethod(tpl, "nextBatch", NextBatch);
+        SetPrototypeMethod(tpl, "toBuffer", ToBuffer);
 
         constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
         Nan::Set(
@@ -394,11 +281,17 @@ class CompactIterator : public Nan::ObjectWrap {
     std::vector<node_position> stack;
     std::vector<unsigned char> current_word;
     bool return_empty{};
-    unsigned int node_size{};
+    // how many more words the walk may yield
+    unsigned int remaining{std::numeric_limits<unsigned int>::max()};
+    // the prefix of a prefix walk, which batches include in each word
+    std::string prefix;
+    // reused between batches
+    std::string batch;
+    compact_format format{};
 
     static NAN_METHOD(New) {
         if (info.IsConstructCall()) {
-            if (info.Length() != 1 && info.Length() != 2) {
+            if (info.Length() != 1 && info.Length() != 2 && info.Length() != 4) {
                 Nan::ThrowTypeError("Invalid number of arguments");
                 return;
             }
@@ -419,10 +312,23 @@ class CompactIterator : public Nan::ObjectWrap {
 
             auto* full_data = reinterpret_cast<unsigned char*>(node::Buffer::Data(bufferObj));
             obj->data = full_data + DAWG_HEADER_SIZE;
-            obj->node_size = static_cast<unsigned int>(full_data[6]);
+            obj->format = read_compact_format(full_data);
             obj->return_empty = false;
 
-            if (info.Length() == 2) {
+            if (info.Length() == 4) {
+                // we're walking a range of entries, so jump straight to the
+                // first one
+                if (!info[2]->IsUint32() || !info[3]->IsUint32()) {
+                    Nan::ThrowTypeError("start and count must be Numbers");
+                    return;
+                }
+                if (!has_entry_counts(obj->format.node_size)) {
+                    Nan::ThrowError("ranged iteration requires a dawg with embedded counts");
+                    return;
+                }
+                obj->remaining = info[3]->Uint32Value();
+                compact_iterator_seek(obj->format, obj->data, info[2]->Uint32Value(), &obj->stack, &obj->current_word);
+            } else if (info.Length() == 2) {
                 // we're doing a prefix search, so find the prefix node and
                 // enqueue it if it exists
                 String::Utf8Value utf8_value(info[1].As<String>());
@@ -430,21 +336,18 @@ class CompactIterator : public Nan::ObjectWrap {
                 auto* search = reinterpret_cast<unsigned char*>(*utf8_value);
                 size_t search_length = utf8_value.length();
 
-                dawg_search_result result = compact_dawg_search(obj->data, search, search_length, obj->node_size);
+                obj->prefix.assign(reinterpret_cast<char*>(search), search_length);
+                dawg_search_result result = compact_dawg_search(obj->format, obj->data, search, search_length);
 
                 if (result.found) {
                     if (result.final) {
                         obj->return_empty = true;
                     }
-                    if (result.node_offset != -1) {
-                        obj->stack.emplace_back(result.node_offset, 0, false);
-                    }
+                    compact_iterator_start(obj->format, obj->data, result.node_offset, result.tail_index, &obj->stack, &obj->current_word);
                 }
             } else {
                 // enqueue the root if the structure isn't empty
-                if (obj->data[0] > 0) {
-                    obj->stack.emplace_back(0, 0, false);
-                }
+                compact_iterator_start(obj->format, obj->data, 0, 0, &obj->stack, &obj->current_word);
             }
         } else {
             Nan::ThrowTypeError("CompactDawgIterator needs to be called as a constructor");
@@ -454,76 +357,108 @@ class CompactIterator : public Nan::ObjectWrap {
     static NAN_METHOD(Next) {
         auto* obj = Nan::ObjectWrap::Unwrap<CompactIterator>(info.This());
 
+        if (obj->remaining == 0) {
+            return;
+        }
+
         if (obj->return_empty) {
             obj->return_empty = false;
+            obj->remaining--;
             info.GetReturnValue().Set(Nan::New("").ToLocalChecked());
             return;
         }
 
-        unsigned char* data = obj->data;
-        std::vector<node_position>* stack = &(obj->stack);
-        std::vector<unsigned char>* current_word = &(obj->current_word);
+        std::string output;
+        bool has_output = compact_iterator_next(obj->format, obj->data, &(obj->stack), &(obj->current_word), &output);
+
+        if (has_output) {
+            obj->remaining--;
+            info.GetReturnValue().Set(Nan::New(output).ToLocalChecked());
+        }
+    }
+
+    // Returns an Array of up to the given number of next words, which is
+    // empty once the walk is done. Saves a call per word over Next.
+    static NAN_METHOD(NextChunk) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactIterator>(info.This());
 
-        unsigned int flagged_offset, next_final = 0;
-        unsigned int next_offset = 0, edge_count = 0, edge_offset = 0;
-        unsigned char letter;
+        if (info.Length() != 1 || !info[0]->IsUint32()) {
+            Nan::ThrowTypeError("chunk size must be a Number");
+            return;
+        }
+        unsigned int size = std::min(info[0]->Uint32Value(), obj->remaining);
 
+        v8::Local<v8::Array> out = Nan::New<v8::Array>();
+        uint32_t count = 0;
+        if (size > 0 && obj->return_empty) {
+            obj->return_empty = false;
+            Nan::Set(out, count++, Nan::New("").ToLocalChecked());
+        }
         std::string output;
-        bool has_output = false;
-
-        while (!stack->empty() && !has_output) {
-            node_position const& current_position = stack->back();
-            // NOTE: since `pop_back()` below will invalidate iterators
-            // we work with copies of the node_position data rather
-            // than the node_position reference itself (which may become invalid)
-            unsigned int cur_off = current_position.node_offset;
-            unsigned int cur_idx = current_position.edge_idx;
-            bool cur_visited = current_position.visited;
-
-            edge_offset = cur_off + obj->node_size + (5 * cur_idx);
-            letter = data[edge_offset];
-
-            memcpy(&flagged_offset, &(data[edge_offset + 1]), sizeof(unsigned int));
-            next_offset = static_cast<int>(flagged_offset & FINAL_MASK);
-            next_final = flagged_offset & IS_FINAL_FLAG;
-
-            if ((next_final != 0u) && !cur_visited) {
-                has_output = true;
-                output = std::string(current_word->begin(), current_word->end()) + reinterpret_cast<char&>(letter);
+        while (count < size) {
+            output.clear();
+            if (!compact_iterator_next(obj->format, obj->data, &(obj->stack), &(obj->current_word), &output)) {
+                break;
             }
+            Nan::Set(out, count++, Nan::New(output).ToLocalChecked());
+        }
+        obj->remaining -= count;
+        info.GetReturnValue().Set(out);
+    }
 
-            if (next_offset == 0 || data[next_offset] == 0 || cur_visited) {
-                stack->pop_back();
+    // Appends up to `size` next words, with the prefix the walk started
+    // from and each followed by a newline, to obj->batch. Returns how many
+    // were written.
+    static unsigned int write_batch(CompactIterator* obj, unsigned int size) {
+        size = std::min(size, obj->remaining);
+        unsigned int count = 0;
+        if (size > 0 && obj->return_empty) {
+            obj->return_empty = false;
+            obj->batch.append(obj->prefix);
+            obj->batch.push_back('\n');
+            count++;
+        }
+        while (count < size) {
+            std::size_t start = obj->batch.size();
+            obj->batch.append(obj->prefix);
+            if (!compact_iterator_next(obj->format, obj->data, &(obj->stack), &(obj->current_word), &(obj->batch))) {
+                obj->batch.resize(start);
+                break;
+            }
+            obj->batch.push_back('\n');
+            count++;
+        }
+        obj->remaining -= count;
+        return count;
+    }
 
-                if (!stack->empty()) {
-                    node_position& latest_back = stack->back();
-                    latest_back.visited = true;
-                }
+    // Returns a Buffer of up to the given number of next words, each
+    // followed by a newline, or undefined once the walk is done. Unlike
+    // Next, the words include the prefix the walk started from.
+    static NAN_METHOD(NextBatch) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactIterator>(info.This());
 
-                edge_count = static_cast<int>(data[cur_off]);
-                if (cur_idx < edge_count - 1) {
-                    // done with the children, but still have siblings so move laterally
-                    unsigned int next_position = cur_idx;
-                    next_position++;
-                    // add a copy to the stack
-                    stack->emplace_back(cur_off, next_position, false);
-                } else {
-                    // otherwise we'll move back up the tree
-                    if (!current_word->empty()) {
-                        current_word->pop_back();
-                    }
-                }
-            } else {
-                // "recurse" down
-                stack->emplace_back(next_offset, 0, false);
-                current_word->push_back(letter);
-            }
+        if (info.Length() != 1 || !info[0]->IsUint32()) {
+            Nan::ThrowTypeError("batch size must be a Number");
+            return;
         }
 
-        if (has_output) {
-            info.GetReturnValue().Set(Nan::New(output).ToLocalChecked());
+        obj->batch.clear();
+        if (write_batch(obj, info[0]->Uint32Value()) > 0) {
+            info.GetReturnValue().Set(Nan::CopyBuffer(obj->batch.data(), static_cast<uint32_t>(obj->batch.size())).ToLocalChecked());
         }
     }
+
+    // Returns all the remaining words in one Buffer, as NextBatch does.
+    static NAN_METHOD(ToBuffer) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactIterator>(info.This());
+
+        obj->batch.clear();
+        write_batch(obj, obj->remaining);
+        info.GetReturnValue().Set(Nan::CopyBuffer(obj->batch.data(), static_cast<uint32_t>(obj->batch.size())).ToLocalChecked());
+        obj->batch.clear();
+        obj->batch.shrink_to_fit();
+    }
 };
 
 class CompactDawg : public Nan::ObjectWrap {
@@ -533,7 +468,17 @@ class CompactDawg : public Nan::ObjectWrap {
         tpl->SetClassName(Nan::New("CompactDawg").ToLocalChecked());
         tpl->InstanceTemplate()->SetInternalFieldCount(1);
         SetPrototypeMethod(tpl, "_lookup", Lookup);
+        SetPrototypeMethod(tpl, "_lookupMany", LookupMany);
+        SetPrototypeMethod(tpl, "decodeIndices", DecodeIndices);
+        SetPrototypeMethod(tpl, "lookupCountsInto", LookupCountsInto);
+        SetPrototypeMethod(tpl, "lookupManyCountsInto", LookupManyCountsInto);
         SetPrototypeMethod(tpl, "_iterator", Iterator);
+        SetPrototypeMethod(tpl, "_rangeIterator", RangeIterator);
+        SetPrototypeMethod(tpl, "_lowerBound", LowerBound);
+        SetPrototypeMethod(tpl, "_fuzzyLookup", FuzzyLookup);
+        SetPrototypeMethod(tpl, "_prefixesOf", PrefixesOf);
+        SetPrototypeMethod(tpl, "setScores", SetScores);
+        SetPrototypeMethod(tpl, "_complete", Complete);
         constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
         Nan::Set(
             target,
@@ -551,14 +496,23 @@ class CompactDawg : public Nan::ObjectWrap {
     explicit CompactDawg(v8::Local<v8::Object> buf)
         : data(node::Buffer::Data(buf) + DAWG_HEADER_SIZE),
           len(node::Buffer::Length(buf)),
-          node_size(static_cast<unsigned int>(node::Buffer::Data(buf)[6])) {
+          format(read_compact_format(reinterpret_cast<unsigned char*>(node::Buffer::Data(buf)))) {
         persistentBuffer.Reset(buf);
     }
-    ~CompactDawg() override { persistentBuffer.Reset(); }
+    ~CompactDawg() override {
+        persistentBuffer.Reset();
+        persistentScores.Reset();
+    }
     char* data;
     size_t len;
-    unsigned int node_size;
+    compact_format format;
     Nan::Persistent<v8::Object> persistentBuffer;
+    // set by setScores, for completions
+    Nan::Persistent<v8::Object> persistentScores;
+    score_table scores;
+    // reused by the *Into lookups so that they don't allocate once warm
+    std::vector<search_key> key_scratch;
+    std::string arena_scratch;
 
     static NAN_METHOD(New) {
         if (info.IsConstructCall()) {
@@ -594,7 +548,7 @@ class CompactDawg : public Nan::ObjectWrap {
         // https://github.com/nodejs/node/pull/1042
         if (!js_val.IsEmpty()) {
             if (js_val->IsNumber()) {
-                result = inverse_compact_dawg_search(reinterpret_cast<unsigned char*>(obj->data), js_val->IntegerValue(), obj->node_size);
+                result = inverse_compact_dawg_search(obj->format, reinterpret_cast<unsigned char*>(obj->data), js_val->IntegerValue());
                 return_val = 2;
             } else {
                 v8::Local<v8::String> js_str = js_val->ToString();
@@ -616,10 +570,10 @@ class CompactDawg : public Nan::ObjectWrap {
                         if (len > arena_size) {
                             std::string arena(len, '\0');
                             std::size_t utf8_length = js_str->WriteUtf8(&arena[0], static_cast<int>(len), nullptr, flags);
-                            if (obj->node_size == INCLUDES_ENTRY_COUNT) {
-                                result = counted_compact_dawg_search(reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(&arena[0]), utf8_length, obj->node_size);
+                            if (has_entry_counts(obj->format.node_size)) {
+                                result = counted_compact_dawg_search(obj->format, reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(&arena[0]), utf8_length);
                             } else {
-                                result = compact_dawg_search(reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(&arena[0]), utf8_length, obj->node_size);
+                                result = compact_dawg_search(obj->format, reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(&arena[0]), utf8_length);
                             }
                             if (result.found) {
                                 return_val = result.final ? 2 : 1;
@@ -635,10 +589,10 @@ class CompactDawg : public Nan::ObjectWrap {
                                 return;
                             }
                             arena[utf8_length] = '\0'; // NOLINT (cppcoreguidelines-pro-bounds-constant-array-index)
-                            if (obj->node_size == INCLUDES_ENTRY_COUNT) {
-                                result = counted_compact_dawg_search(reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(arena), utf8_length, obj->node_size);
+                            if (has_entry_counts(obj->format.node_size)) {
+                                result = counted_compact_dawg_search(obj->format, reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(arena), utf8_length);
                             } else {
-                                result = compact_dawg_search(reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(arena), utf8_length, obj->node_size);
+                                result = compact_dawg_search(obj->format, reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(arena), utf8_length);
                             }
                             if (result.found) {
                                 return_val = result.final ? 2 : 1;
@@ -666,6 +620,210 @@ class CompactDawg : public Nan::ObjectWrap {
         info.GetReturnValue().Set(return_val);
     }
 
+    // Looks up every key in an array of strings, or in a buffer of
+    // newline-delimited keys, in one call. Returns a Uint8Array of flags
+    // for exact and prefix lookups, and an Int32Array of indexes (-1 for
+    // missing keys) for counts lookups.
+    static NAN_METHOD(LookupMany) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 2 || !info[1]->IsUint32()) {
+            Nan::ThrowTypeError("Invalid arguments");
+            return;
+        }
+
+        unsigned int mode = info[1]->Uint32Value();
+        if (mode > LOOKUP_MANY_COUNTS) {
+            Nan::ThrowTypeError("unknown lookup mode");
+            return;
+        }
+        if (mode == LOOKUP_MANY_COUNTS && !has_entry_counts(obj->format.node_size)) {
+            Nan::ThrowError("counts lookups require a dawg with embedded counts");
+            return;
+        }
+
+        std::vector<search_key> keys;
+        // utf8 copies of string keys; buffer keys are used in place
+        std::string arena;
+        const unsigned char* base;
+        if (!read_search_keys(info[0], &keys, &arena, &base)) {
+            return;
+        }
+
+        auto* data = reinterpret_cast<unsigned char*>(obj->data);
+        std::size_t num_keys = keys.size();
+
+        if (mode == LOOKUP_MANY_COUNTS) {
+            v8::Local<v8::Int32Array> out = v8::Int32Array::New(
+                v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), num_keys * sizeof(int32_t)), 0, num_keys);
+            Nan::TypedArrayContents<int32_t> indexes(out);
+            for (std::size_t i = 0; i < num_keys; i++) {
+                dawg_search_result result = counted_compact_dawg_search(obj->format, data, base + keys[i].offset, keys[i].length);
+                (*indexes)[i] = (result.found && result.final) ? result.skipped : -1;
+            }
+            info.GetReturnValue().Set(out);
+        } else {
+            v8::Local<v8::Uint8Array> out = v8::Uint8Array::New(
+                v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), num_keys), 0, num_keys);
+            Nan::TypedArrayContents<uint8_t> flags(out);
+            compact_dawg_search_many(obj->format, data, base, keys.data(), num_keys, *flags);
+            for (std::size_t i = 0; i < num_keys; i++) {
+                bool matched = mode == LOOKUP_MANY_EXACT ? (*flags)[i] == 2 : (*flags)[i] != 0;
+                (*flags)[i] = matched ? 1 : 0;
+            }
+            info.GetReturnValue().Set(out);
+        }
+    }
+
+    // Writes the counted lookup of a key into out[0..2]: 0, 1 or 2 for not
+    // found, found as a prefix, or found as a word; then its index (or -1)
+    // and the number of words it prefixes, itself included (or 0).
+    static void write_counts(compact_format const& format, unsigned char* data, const unsigned char* key, std::size_t length, int32_t* out) {
+        if (length == 0) {
+            // the empty key prefixes every word
+            out[0] = 1;
+            out[1] = 0;
+            out[2] = compact_entry_count(format, data, 0);
+            return;
+        }
+        dawg_search_result result = counted_compact_dawg_search(format, data, key, length);
+        if (!result.found) {
+            out[0] = 0;
+            out[1] = -1;
+            out[2] = 0;
+            return;
+        }
+        out[0] = result.final ? 2 : 1;
+        out[1] = result.skipped;
+        out[2] = result.child_count;
+    }
+
+    // Like lookupPrefixCounts, but writes into the first three values of an
+    // Int32Array (see write_counts) instead of allocating a result, and
+    // returns the status value.
+    static NAN_METHOD(LookupCountsInto) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 2 || !info[0]->IsString() || !info[1]->IsInt32Array()) {
+            Nan::ThrowTypeError("arguments must be a String and an Int32Array");
+            return;
+        }
+        if (!has_entry_counts(obj->format.node_size)) {
+            Nan::ThrowError("counts lookups require a dawg with embedded counts");
+            return;
+        }
+        Nan::TypedArrayContents<int32_t> out(info[1]);
+        if (out.length() < 3) {
+            Nan::ThrowRangeError("output must hold at least 3 values");
+            return;
+        }
+
+        v8::Local<v8::String> js_str = info[0].As<v8::String>();
+        const int flags = v8::String::NO_NULL_TERMINATION | v8::String::REPLACE_INVALID_UTF8;
+        // as in Lookup, reserve the maximum possible utf8 length
+        std::size_t max_length = 3 * static_cast<std::size_t>(js_str->Length());
+        if (obj->arena_scratch.size() < max_length) {
+            obj->arena_scratch.resize(max_length);
+        }
+        std::size_t utf8_length = js_str->WriteUtf8(&obj->arena_scratch[0], static_cast<int>(max_length), nullptr, flags);
+
+        write_counts(obj->format, reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<const unsigned char*>(obj->arena_scratch.data()), utf8_length, *out);
+        info.GetReturnValue().Set((*out)[0]);
+    }
+
+    // The batched form of LookupCountsInto: takes keys as LookupMany does and
+    // writes three values per key, in order, into an Int32Array.
+    static NAN_METHOD(LookupManyCountsInto) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 2 || !info[1]->IsInt32Array()) {
+            Nan::ThrowTypeError("second argument must be an Int32Array");
+            return;
+        }
+        if (!has_entry_counts(obj->format.node_size)) {
+            Nan::ThrowError("counts lookups require a dawg with embedded counts");
+            return;
+        }
+
+        const unsigned char* base;
+        if (!read_search_keys(info[0], &obj->key_scratch, &obj->arena_scratch, &base)) {
+            return;
+        }
+        std::size_t num_keys = obj->key_scratch.size();
+        Nan::TypedArrayContents<int32_t> out(info[1]);
+        if (out.length() < 3 * num_keys) {
+            Nan::ThrowRangeError("output must hold 3 values per key");
+            return;
+        }
+
+        auto* data = reinterpret_cast<unsigned char*>(obj->data);
+        for (std::size_t i = 0; i < num_keys; i++) {
+            search_key const& key = obj->key_scratch[i];
+            write_counts(obj->format, data, base + key.offset, key.length, *out + (3 * i));
+        }
+        info.GetReturnValue().Set(static_cast<uint32_t>(num_keys));
+    }
+
+    // Turns a Uint32Array (or an Array of Numbers) of indexes back into an
+    // Array of words, with null for indexes past the end of the dawg.
+    static NAN_METHOD(DecodeIndices) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 1) {
+            Nan::ThrowTypeError("Invalid number of arguments");
+            return;
+        }
+        if (!has_entry_counts(obj->format.node_size)) {
+            Nan::ThrowError("index lookups require a dawg with embedded counts");
+            return;
+        }
+
+        std::vector<unsigned int> indexes;
+        if (info[0]->IsUint32Array()) {
+            Nan::TypedArrayContents<uint32_t> input(info[0].As<v8::Uint32Array>());
+            indexes.assign(*input, *input + input.length());
+        } else if (info[0]->IsArray()) {
+            v8::Local<v8::Array> input = info[0].As<v8::Array>();
+            uint32_t length = input->Length();
+            indexes.reserve(length);
+            for (uint32_t i = 0; i < length; i++) {
+                v8::Local<v8::Value> js_val = Nan::Get(input, i).ToLocalChecked();
+                if (!js_val->IsUint32()) {
+                    Nan::ThrowTypeError("indexes must be non-negative integers");
+                    return;
+                }
+                indexes.push_back(js_val->Uint32Value());
+            }
+        } else {
+            Nan::ThrowTypeError("first argument must be a Uint32Array or an Array of Numbers");
+            return;
+        }
+
+        // decode in sorted order, which lets neighbouring indexes share the
+        // walk down to their common prefix
+        std::vector<uint32_t> order(indexes.size());
+        for (std::size_t i = 0; i < order.size(); i++) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        if (!std::is_sorted(indexes.begin(), indexes.end())) {
+            std::stable_sort(order.begin(), order.end(), [&indexes](uint32_t a, uint32_t b) {
+                return indexes[a] < indexes[b];
+            });
+        }
+
+        compact_index_decoder decoder(obj->format, reinterpret_cast<unsigned char*>(obj->data));
+        v8::Local<v8::Array> out = Nan::New<v8::Array>(static_cast<int>(indexes.size()));
+        for (uint32_t i : order) {
+            if (decoder.decode(indexes[i])) {
+                std::string const& word = decoder.word();
+                Nan::Set(out, i, Nan::New(word.data(), static_cast<int>(word.size())).ToLocalChecked());
+            } else {
+                Nan::Set(out, i, Nan::Null());
+            }
+        }
+        info.GetReturnValue().Set(out);
+    }
+
     static NAN_METHOD(Iterator) {
         auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
         v8::Local<v8::Object> buf = Nan::New(obj->persistentBuffer);
@@ -687,6 +845,284 @@ class CompactDawg : public Nan::ObjectWrap {
         }
     }
 
+    // Attaches a score table, from buildScoreTable, for completions. The
+    // table is used in place, so it can be memory-mapped.
+    static NAN_METHOD(SetScores) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 1 || !node::Buffer::HasInstance(info[0])) {
+            Nan::ThrowTypeError("first argument must be a Buffer");
+            return;
+        }
+        if (!has_entry_counts(obj->format.node_size)) {
+            Nan::ThrowError("scores require a dawg with embedded counts");
+            return;
+        }
+
+        v8::Local<v8::Object> buf = info[0]->ToObject();
+        score_table table;
+        if (!table.read(reinterpret_cast<unsigned char*>(node::Buffer::Data(buf)), node::Buffer::Length(buf))) {
+            Nan::ThrowError("not a valid score table");
+            return;
+        }
+        if (table.count != static_cast<unsigned int>(compact_entry_count(obj->format, reinterpret_cast<unsigned char*>(obj->data), 0))) {
+            Nan::ThrowError("score table doesn't have a score for each entry");
+            return;
+        }
+        obj->persistentScores.Reset(buf);
+        obj->scores = table;
+    }
+
+    // Returns the best-scoring words starting with a prefix as a flat Array
+    // of word, index and score for each.
+    static NAN_METHOD(Complete) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 2 || !info[0]->IsString() || !info[1]->IsUint32()) {
+            Nan::ThrowTypeError("Invalid arguments");
+            return;
+        }
+        if (obj->scores.scores == nullptr) {
+            Nan::ThrowError("completions require scores; call setScores first");
+            return;
+        }
+
+        String::Utf8Value utf8_value(info[0].As<String>());
+        std::vector<completion> completions = compact_top_completions(obj->format,
+                                                                      reinterpret_cast<unsigned char*>(obj->data),
+                                                                      obj->scores,
+                                                                      reinterpret_cast<unsigned char*>(*utf8_value),
+                                                                      utf8_value.length(),
+                                                                      info[1]->Uint32Value());
+
+        v8::Local<v8::Array> out = Nan::New<v8::Array>(static_cast<int>(completions.size() * 3));
+        for (std::size_t i = 0; i < completions.size(); i++) {
+            auto slot = static_cast<uint32_t>(3 * i);
+            Nan::Set(out, slot, Nan::New(completions[i].word).ToLocalChecked());
+            Nan::Set(out, slot + 1, Nan::New(completions[i].index));
+            Nan::Set(out, slot + 2, Nan::New(completions[i].score));
+        }
+        info.GetReturnValue().Set(out);
+    }
+
+    // Returns the prefixes of a key that are words as a flat Array of byte
+    // length and index (-1 without counts) for each.
+    static NAN_METHOD(PrefixesOf) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 1 || !info[0]->IsString()) {
+            Nan::ThrowTypeError("first argument must be a String");
+            return;
+        }
+
+        String::Utf8Value utf8_value(info[0].As<String>());
+        std::vector<prefix_match> matches;
+        compact_prefixes_of(obj->format, reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(*utf8_value), utf8_value.length(), &matches);
+
+        v8::Local<v8::Array> out = Nan::New<v8::Array>(static_cast<int>(matches.size() * 2));
+        for (std::size_t i = 0; i < matches.size(); i++) {
+            auto slot = static_cast<uint32_t>(2 * i);
+            Nan::Set(out, slot, Nan::New(static_cast<uint32_t>(matches[i].length)));
+            Nan::Set(out, slot + 1, Nan::New(matches[i].index));
+        }
+        info.GetReturnValue().Set(out);
+    }
+
+    // Returns the words within an edit distance of a key as a flat Array of
+    // word, distance and index (-1 without counts) for each.
+    static NAN_METHOD(FuzzyLookup) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 4 || !info[0]->IsString() || !info[1]->IsUint32() || !info[3]->IsUint32()) {
+            Nan::ThrowTypeError("Invalid arguments");
+            return;
+        }
+
+        String::Utf8Value utf8_value(info[0].As<String>());
+        compact_fuzzy_search search(obj->format,
+                                    reinterpret_cast<unsigned char*>(obj->data),
+                                    reinterpret_cast<unsigned char*>(*utf8_value),
+                                    utf8_value.length(),
+                                    info[1]->Uint32Value(),
+                                    info[2]->BooleanValue(),
+                                    info[3]->Uint32Value());
+        std::vector<fuzzy_match> matches = search.run();
+
+        v8::Local<v8::Array> out = Nan::New<v8::Array>(static_cast<int>(matches.size() * 3));
+        for (std::size_t i = 0; i < matches.size(); i++) {
+            auto slot = static_cast<uint32_t>(3 * i);
+            Nan::Set(out, slot, Nan::New(matches[i].word).ToLocalChecked());
+            Nan::Set(out, slot + 1, Nan::New(matches[i].distance));
+            Nan::Set(out, slot + 2, Nan::New(matches[i].index));
+        }
+        info.GetReturnValue().Set(out);
+    }
+
+    // Returns an iterator over `count` entries starting at index `start`.
+    static NAN_METHOD(RangeIterator) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 2 || !info[0]->IsUint32() || !info[1]->IsUint32()) {
+            Nan::ThrowTypeError("start and count must be Numbers");
+            return;
+        }
+        if (!has_entry_counts(obj->format.node_size)) {
+            Nan::ThrowError("ranged iteration requires a dawg with embedded counts");
+            return;
+        }
+
+        v8::Local<v8::Value> argv[4] = {Nan::New(obj->persistentBuffer), Nan::Undefined(), info[0], info[1]};
+        info.GetReturnValue().Set(Nan::NewInstance(
+                                      Nan::New(CompactIterator::constructor()),
+                                      4,
+                                      argv)
+                                      .ToLocalChecked());
+    }
+
+    // Returns the index of the first word at or after a key.
+    static NAN_METHOD(LowerBound) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawg>(info.This());
+
+        if (info.Length() != 1 || !info[0]->IsString()) {
+            Nan::ThrowTypeError("key must be a String");
+            return;
+        }
+        if (!has_entry_counts(obj->format.node_size)) {
+            Nan::ThrowError("ranged iteration requires a dawg with embedded counts");
+            return;
+        }
+
+        String::Utf8Value utf8_value(info[0].As<String>());
+        unsigned int index = compact_lower_bound(obj->format, reinterpret_cast<unsigned char*>(obj->data), reinterpret_cast<unsigned char*>(*utf8_value), utf8_value.length());
+        info.GetReturnValue().Set(index);
+    }
+
+    static inline Nan::Persistent<v8::Function>& constructor() {
+        static Nan::Persistent<v8::Function> my_constructor;
+        return my_constructor;
+    }
+};
+
+// Up to MAX_DAWG_SET_SIZE compact dawgs, looked up together: each lookup
+// returns a mask of which dawgs have the key (see compact_dawg_set_search).
+class CompactDawgSet : public Nan::ObjectWrap {
+  public:
+    static void Init(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
+        v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+        tpl->SetClassName(Nan::New("CompactDawgSet").ToLocalChecked());
+        tpl->InstanceTemplate()->SetInternalFieldCount(1);
+        SetPrototypeMethod(tpl, "_lookup", Lookup);
+        SetPrototypeMethod(tpl, "_lookupMany", LookupMany);
+        constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
+        Nan::Set(
+            target,
+            Nan::New("CompactDawgSet").ToLocalChecked(),
+            Nan::GetFunction(tpl).ToLocalChecked());
+    }
+
+    // non copyable/movable
+    CompactDawgSet(CompactDawgSet const&) = delete;
+    CompactDawgSet& operator=(CompactDawgSet const&) = delete;
+    CompactDawgSet(CompactDawgSet&&) = delete;
+    CompactDawgSet& operator=(CompactDawgSet&&) = delete;
+
+  private:
+    explicit CompactDawgSet() = default;
+    ~CompactDawgSet() override { persistentBuffers.Reset(); }
+
+    // our own copy of the buffers' array, which keeps them alive
+    Nan::Persistent<v8::Array> persistentBuffers;
+    std::vector<dawg_set_member> members;
+
+    static NAN_METHOD(New) {
+        if (!info.IsConstructCall()) {
+            Nan::ThrowTypeError("CompactDawgSet needs to be called as a constructor");
+            return;
+        }
+        if (info.Length() != 1 || !info[0]->IsArray()) {
+            Nan::ThrowTypeError("first argument must be an Array of Buffers");
+            return;
+        }
+
+        v8::Local<v8::Array> list = info[0].As<v8::Array>();
+        if (list->Length() > MAX_DAWG_SET_SIZE) {
+            Nan::ThrowRangeError("a CompactDawgSet holds at most 32 dawgs");
+            return;
+        }
+
+        v8::Local<v8::Array> buffers = Nan::New<v8::Array>(list->Length());
+        std::vector<dawg_set_member> members;
+        for (uint32_t i = 0; i < list->Length(); i++) {
+            v8::Local<v8::Value> item = Nan::Get(list, i).ToLocalChecked();
+            if (!node::Buffer::HasInstance(item)) {
+                Nan::ThrowTypeError("first argument must be an Array of Buffers");
+                return;
+            }
+            Nan::Set(buffers, i, item);
+            auto* full_data = reinterpret_cast<unsigned char*>(node::Buffer::Data(item));
+            members.push_back({read_compact_format(full_data), full_data + DAWG_HEADER_SIZE});
+        }
+
+        auto* set = new CompactDawgSet();
+        set->persistentBuffers.Reset(buffers);
+        set->members = std::move(members);
+        set->Wrap(info.This());
+        Nan::Set(info.This(), Nan::New("size").ToLocalChecked(), Nan::New(list->Length()));
+        info.GetReturnValue().Set(info.This());
+    }
+
+    // Takes a key and LOOKUP_MANY_EXACT or LOOKUP_MANY_PREFIX; returns the
+    // mask of dawgs that have it.
+    static NAN_METHOD(Lookup) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawgSet>(info.This());
+
+        if (info.Length() != 2 || !info[0]->IsString() || !info[1]->IsUint32()) {
+            Nan::ThrowTypeError("Invalid arguments");
+            return;
+        }
+        unsigned int mode = info[1]->Uint32Value();
+        if (mode > LOOKUP_MANY_PREFIX) {
+            Nan::ThrowTypeError("unknown lookup mode");
+            return;
+        }
+
+        String::Utf8Value utf8_value(info[0].As<String>());
+        unsigned int mask = compact_dawg_set_search(obj->members.data(), obj->members.size(), reinterpret_cast<unsigned char*>(*utf8_value), utf8_value.length(), mode == LOOKUP_MANY_PREFIX);
+        info.GetReturnValue().Set(mask);
+    }
+
+    // As Lookup, for keys given as CompactDawg::LookupMany takes them;
+    // returns a Uint32Array of masks.
+    static NAN_METHOD(LookupMany) {
+        auto* obj = Nan::ObjectWrap::Unwrap<CompactDawgSet>(info.This());
+
+        if (info.Length() != 2 || !info[1]->IsUint32()) {
+            Nan::ThrowTypeError("Invalid arguments");
+            return;
+        }
+        unsigned int mode = info[1]->Uint32Value();
+        if (mode > LOOKUP_MANY_PREFIX) {
+            Nan::ThrowTypeError("unknown lookup mode");
+            return;
+        }
+
+        std::vector<search_key> keys;
+        std::string arena;
+        const unsigned char* base;
+        if (!read_search_keys(info[0], &keys, &arena, &base)) {
+            return;
+        }
+
+        std::size_t num_keys = keys.size();
+        v8::Local<v8::Uint32Array> out = v8::Uint32Array::New(
+            v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), num_keys * sizeof(uint32_t)), 0, num_keys);
+        Nan::TypedArrayContents<uint32_t> masks(out);
+        for (std::size_t i = 0; i < num_keys; i++) {
+            (*masks)[i] = compact_dawg_set_search(obj->members.data(), obj->members.size(), base + keys[i].offset, keys[i].length, mode == LOOKUP_MANY_PREFIX);
+        }
+        info.GetReturnValue().Set(out);
+    }
+
     static inline Nan::Persistent<v8::Function>& constructor() {
         static Nan::Persistent<v8::Function> my_constructor;
         return my_constructor;
@@ -713,11 +1149,457 @@ NAN_METHOD(Crc32c) {
     info.GetReturnValue().Set(Nan::New<v8::Uint32>(crc));
 }
 
+// Calculates the checksum of a buffer on the threadpool, so that large
+// (e.g. memory-mapped) dawgs can be verified without blocking the loop.
+class Crc32cWorker : public Nan::AsyncWorker {
+  public:
+    Crc32cWorker(Nan::Callback* callback, v8::Local<v8::Object> buf)
+        : Nan::AsyncWorker(callback),
+          data(reinterpret_cast<unsigned char*>(node::Buffer::Data(buf))),
+          length(node::Buffer::Length(buf)) {
+        // keep the buffer alive until we're done reading it
+        SaveToPersistent("buffer", buf);
+    }
+
+    void Execute() override {
+        crc = crc32c(data, length);
+    }
+
+    void HandleOKCallback() override {
+        Nan::HandleScope scope;
+        v8::Local<v8::Value> argv[2] = {Nan::Null(), Nan::New<v8::Uint32>(crc)};
+        callback->Call(2, argv, async_resource);
+    }
+
+  private:
+    unsigned char* data;
+    std::size_t length;
+    uint32_t crc{};
+};
+
+NAN_METHOD(Crc32cAsync) {
+    if (info.Length() != 2) {
+        Nan::ThrowTypeError("Invalid number of arguments");
+        return;
+    }
+
+    if (!node::Buffer::HasInstance(info[0])) {
+        Nan::ThrowTypeError("Input must be a buffer");
+        return;
+    }
+
+    if (!info[1]->IsFunction()) {
+        Nan::ThrowTypeError("second argument must be a callback");
+        return;
+    }
+
+    auto* callback = new Nan::Callback(info[1].As<v8::Function>());
+    Nan::AsyncQueueWorker(new Crc32cWorker(callback, info[0]->ToObject()));
+}
+
+// Maps a file read-only and wraps the mapping in a Buffer, which unmaps it
+// once the Buffer (and everything holding on to it) has been collected.
+// The pages are shared with the page cache, so they are loaded lazily and
+// shared between processes mapping the same file.
+NAN_METHOD(MapFile) {
+    if (info.Length() != 1 || !info[0]->IsString()) {
+        Nan::ThrowTypeError("first argument must be a String");
+        return;
+    }
+
+    String::Utf8Value path(info[0].As<String>());
+    int fd = open(*path, O_RDONLY);
+    if (fd == -1) {
+        Nan::ThrowError((std::string("could not open ") + *path).c_str());
+        return;
+    }
+
+    struct stat file_info {};
+    if (fstat(fd, &file_info) != 0) {
+        close(fd);
+        Nan::ThrowError((std::string("could not stat ") + *path).c_str());
+        return;
+    }
+
+    auto size = static_cast<std::size_t>(file_info.st_size);
+    if (size < DAWG_HEADER_SIZE) {
+        close(fd);
+        Nan::ThrowError("file is too small to contain a dawg");
+        return;
+    }
+    if (size > node::Buffer::kMaxLength) {
+        close(fd);
+        Nan::ThrowError("file is too large to be mapped into a buffer");
+        return;
+    }
+
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (mapping == MAP_FAILED) { // NOLINT (MAP_FAILED is a C-style cast)
+        Nan::ThrowError((std::string("could not map ") + *path).c_str());
+        return;
+    }
+
+    Nan::MaybeLocal<v8::Object> out = Nan::NewBuffer(
+        static_cast<char*>(mapping),
+        size,
+        unmap_dawg_file,
+        reinterpret_cast<void*>(size));
+    info.GetReturnValue().Set(out.ToLocalChecked());
+}
+
+// Builds a compact dawg from a file of sorted, newline-delimited words on
+// the threadpool, spreading the dawg construction over `threads` threads of
+// its own when asked to. With a nonzero `sort_memory` the words may come in
+// any order instead, and are sorted in runs of that many bytes, spilled to
+// `temp_dir` (see read_dawg_unsorted). If an output path is given the dawg
+// is streamed to that file, otherwise it's handed to the callback as a
+// Buffer.
+class BuildCompactDawgWorker : public Nan::AsyncWorker {
+  public:
+    BuildCompactDawgWorker(Nan::Callback* callback, std::string in_path, std::string out_path, unsigned int node_size, unsigned int version, unsigned int layout, unsigned int threads, std::size_t sort_memory, std::string temp_dir)
+        : Nan::AsyncWorker(callback),
+          in_path(std::move(in_path)),
+          out_path(std::move(out_path)),
+          node_size(node_size),
+          version(version),
+          layout(layout),
+          threads(threads),
+          sort_memory(sort_memory),
+          temp_dir(std::move(temp_dir)) {}
+    ~BuildCompactDawgWorker() override { delete output; }
+
+    // non copyable/movable
+    BuildCompactDawgWorker(BuildCompactDawgWorker const&) = delete;
+    BuildCompactDawgWorker& operator=(BuildCompactDawgWorker const&) = delete;
+    BuildCompactDawgWorker(BuildCompactDawgWorker&&) = delete;
+    BuildCompactDawgWorker& operator=(BuildCompactDawgWorker&&) = delete;
+
+    void Execute() override {
+        std::ifstream input(in_path);
+        if (!input.is_open()) {
+            SetErrorMessage(("could not open " + in_path).c_str());
+            return;
+        }
+
+        Dawg dawg;
+        if (!read_dawg_input(&input, &dawg, false, threads, sort_memory, temp_dir)) {
+            if (sort_memory > 0) {
+                SetErrorMessage(("could not sort " + in_path).c_str());
+            } else {
+                SetErrorMessage("Entries must be inserted in order");
+            }
+            return;
+        }
+
+        if (out_path.empty()) {
+            output = new std::vector<unsigned char>();
+            build_compact_dawg(&dawg, output, false, node_size, version, layout);
+            return;
+        }
+
+        std::ofstream out(out_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            SetErrorMessage(("could not open " + out_path).c_str());
+            return;
+        }
+        if (!write_compact_dawg(&dawg, &out, false, node_size, version, layout)) {
+            SetErrorMessage(("could not write " + out_path).c_str());
+            out.close();
+            std::remove(out_path.c_str());
+        }
+    }
+
+    void HandleOKCallback() override {
+        Nan::HandleScope scope;
+        if (output == nullptr) {
+            v8::Local<v8::Value> argv[1] = {Nan::Null()};
+            callback->Call(1, argv, async_resource);
+            return;
+        }
+
+        // the buffer takes ownership of the vector
+        std::vector<unsigned char>* result = output;
+        output = nullptr;
+        Nan::MaybeLocal<v8::Object> buf = Nan::NewBuffer(
+            reinterpret_cast<char*>(&((*result)[0])),
+            result->size(),
+            free_dawg_vector,
+            result);
+        v8::Local<v8::Value> argv[2] = {Nan::Null(), buf.ToLocalChecked()};
+        callback->Call(2, argv, async_resource);
+    }
+
+  private:
+    std::string in_path;
+    std::string out_path;
+    unsigned int node_size;
+    unsigned int version;
+    unsigned int layout;
+    unsigned int threads;
+    std::size_t sort_memory;
+    std::string temp_dir;
+    std::vector<unsigned char>* output = nullptr;
+};
+
+NAN_METHOD(BuildCompactDawgFromFile) {
+    if (info.Length() != 9) {
+        Nan::ThrowTypeError("Invalid number of arguments");
+        return;
+    }
+
+    if (!info[0]->IsString()) {
+        Nan::ThrowTypeError("first argument must be a String");
+        return;
+    }
+
+    if (!info[1]->IsUint32()) {
+        Nan::ThrowTypeError("node size must be a Number");
+        return;
+    }
+    unsigned int node_size = info[1]->Uint32Value();
+    if (node_size != EDGE_COUNT_ONLY && node_size != INCLUDES_ENTRY_COUNT && node_size != INCLUDES_EDGE_RANKS) {
+        Nan::ThrowError("unsupported node size");
+        return;
+    }
+
+    if (!info[2]->IsUint32()) {
+        Nan::ThrowTypeError("version must be a Number");
+        return;
+    }
+    unsigned int version = info[2]->Uint32Value();
+    if (!supported_dawg_version(version)) {
+        Nan::ThrowError("unsupported dawg version");
+        return;
+    }
+
+    if (!info[3]->IsUint32()) {
+        Nan::ThrowTypeError("layout must be a Number");
+        return;
+    }
+    unsigned int layout = info[3]->Uint32Value();
+    if (layout != DAWG_LAYOUT_DEPTH_FIRST && layout != DAWG_LAYOUT_HYBRID) {
+        Nan::ThrowError("unsupported dawg layout");
+        return;
+    }
+
+    if (!info[4]->IsUint32() || info[4]->Uint32Value() == 0) {
+        Nan::ThrowTypeError("threads must be a positive Number");
+        return;
+    }
+    unsigned int threads = info[4]->Uint32Value();
+
+    if (!info[5]->IsNumber() || !(info[5]->NumberValue() >= 0)) {
+        Nan::ThrowTypeError("sort memory must be a non-negative Number");
+        return;
+    }
+    auto sort_memory = static_cast<std::size_t>(info[5]->NumberValue());
+
+    std::string temp_dir;
+    if (!info[6]->IsNullOrUndefined()) {
+        if (!info[6]->IsString()) {
+            Nan::ThrowTypeError("temporary directory must be a String");
+            return;
+        }
+        String::Utf8Value temp_value(info[6].As<String>());
+        temp_dir.assign(*temp_value, temp_value.length());
+    }
+
+    std::string out_path;
+    if (!info[7]->IsNullOrUndefined()) {
+        if (!info[7]->IsString()) {
+            Nan::ThrowTypeError("output path must be a String");
+            return;
+        }
+        String::Utf8Value out_value(info[7].As<String>());
+        out_path.assign(*out_value, out_value.length());
+    }
+
+    if (!info[8]->IsFunction()) {
+        Nan::ThrowTypeError("ninth argument must be a callback");
+        return;
+    }
+
+    String::Utf8Value in_value(info[0].As<String>());
+    auto* callback = new Nan::Callback(info[8].As<v8::Function>());
+    Nan::AsyncQueueWorker(new BuildCompactDawgWorker(callback, std::string(*in_value, in_value.length()), out_path, node_size, version, layout, threads, sort_memory, temp_dir));
+}
+
+// Inserts the words of a compact dawg into `dawg`, along with the words in
+// `added` and without those in `deleted` (both sorted), in order. Additions
+// may repeat or already be in the compact dawg; the caller finishes `dawg`.
+void merge_compact_words(compact_format const& format, const unsigned char* data, std::vector<std::string> const& added, std::vector<std::string> const& deleted, Dawg* dawg) {
+    std::vector<node_position> stack;
+    std::vector<unsigned char> current_word;
+    std::string word;
+    compact_iterator_start(format, data, 0, 0, &stack, &current_word);
+    bool base_left = compact_iterator_next(format, data, &stack, &current_word, &word);
+
+    auto next_added = added.begin();
+    auto next_deleted = deleted.begin();
+    while (base_left || next_added != added.end()) {
+        // take the smaller of the next word walked and the next addition
+        bool from_base = base_left && (next_added == added.end() || word <= *next_added);
+        std::string const& candidate = from_base ? word : *next_added;
+
+        while (next_deleted != deleted.end() && *next_deleted < candidate) {
+            ++next_deleted;
+        }
+        bool keep = next_deleted == deleted.end() || *next_deleted != candidate;
+        if (keep && candidate != dawg->previous_word) {
+            dawg->insert(candidate.data(), candidate.size());
+        }
+
+        if (from_base) {
+            word.clear();
+            base_left = compact_iterator_next(format, data, &stack, &current_word, &word);
+        } else {
+            ++next_added;
+        }
+    }
+}
+
+// Rebuilds a compact dawg with some words added and others removed on the
+// threadpool: the base dawg's words are walked in order, merged with the
+// additions and filtered by the deletions into a new Dawg, which is written
+// out with the base's node size and version. Hands the new compact dawg to
+// the callback as a Buffer.
+class MergeCompactDawgWorker : public Nan::AsyncWorker {
+  public:
+    MergeCompactDawgWorker(Nan::Callback* callback, v8::Local<v8::Object> buf, std::vector<std::string> added, std::vector<std::string> deleted, unsigned int layout)
+        : Nan::AsyncWorker(callback),
+          data(reinterpret_cast<unsigned char*>(node::Buffer::Data(buf))),
+          added(std::move(added)),
+          deleted(std::move(deleted)),
+          layout(layout) {
+        // keep the base buffer alive until we're done walking it
+        SaveToPersistent("buffer", buf);
+    }
+    ~MergeCompactDawgWorker() override { delete output; }
+
+    // non copyable/movable
+    MergeCompactDawgWorker(MergeCompactDawgWorker const&) = delete;
+    MergeCompactDawgWorker& operator=(MergeCompactDawgWorker const&) = delete;
+    MergeCompactDawgWorker(MergeCompactDawgWorker&&) = delete;
+    MergeCompactDawgWorker& operator=(MergeCompactDawgWorker&&) = delete;
+
+    void Execute() override {
+        compact_format format = read_compact_format(data);
+        std::sort(added.begin(), added.end());
+        std::sort(deleted.begin(), deleted.end());
+
+        Dawg dawg;
+        merge_compact_words(format, data + DAWG_HEADER_SIZE, added, deleted, &dawg);
+        dawg.finish();
+
+        output = new std::vector<unsigned char>();
+        build_compact_dawg(&dawg, output, false, format.node_size, format.version, layout);
+    }
+
+    void HandleOKCallback() override {
+        Nan::HandleScope scope;
+        // the buffer takes ownership of the vector
+        std::vector<unsigned char>* result = output;
+        output = nullptr;
+        Nan::MaybeLocal<v8::Object> buf = Nan::NewBuffer(
+            reinterpret_cast<char*>(&((*result)[0])),
+            result->size(),
+            free_dawg_vector,
+            result);
+        v8::Local<v8::Value> argv[2] = {Nan::Null(), buf.ToLocalChecked()};
+        callback->Call(2, argv, async_resource);
+    }
+
+  private:
+    unsigned char* data;
+    std::vector<std::string> added;
+    std::vector<std::string> deleted;
+    unsigned int layout;
+    std::vector<unsigned char>* output = nullptr;
+};
+
+// Reads an Array of Strings into utf8 strings; returns false if it isn't
+// one.
+bool read_string_array(v8::Local<v8::Value> value, std::vector<std::string>* out) {
+    if (!value->IsArray()) return false;
+    v8::Local<v8::Array> array = value.As<v8::Array>();
+    for (uint32_t i = 0; i < array->Length(); i++) {
+        v8::Local<v8::Value> item = Nan::Get(array, i).ToLocalChecked();
+        if (!item->IsString()) return false;
+        String::Utf8Value utf8_value(item.As<String>());
+        out->emplace_back(*utf8_value, utf8_value.length());
+    }
+    return true;
+}
+
+NAN_METHOD(MergeCompactDawg) {
+    if (info.Length() != 5) {
+        Nan::ThrowTypeError("Invalid number of arguments");
+        return;
+    }
+
+    if (!node::Buffer::HasInstance(info[0])) {
+        Nan::ThrowTypeError("Input must be a buffer");
+        return;
+    }
+
+    std::vector<std::string> added, deleted;
+    if (!read_string_array(info[1], &added) || !read_string_array(info[2], &deleted)) {
+        Nan::ThrowTypeError("additions and deletions must be Arrays of Strings");
+        return;
+    }
+
+    if (!info[3]->IsUint32()) {
+        Nan::ThrowTypeError("layout must be a Number");
+        return;
+    }
+    unsigned int layout = info[3]->Uint32Value();
+    if (layout != DAWG_LAYOUT_DEPTH_FIRST && layout != DAWG_LAYOUT_HYBRID) {
+        Nan::ThrowError("unsupported dawg layout");
+        return;
+    }
+
+    if (!info[4]->IsFunction()) {
+        Nan::ThrowTypeError("fifth argument must be a callback");
+        return;
+    }
+
+    auto* callback = new Nan::Callback(info[4].As<v8::Function>());
+    Nan::AsyncQueueWorker(new MergeCompactDawgWorker(callback, info[0]->ToObject(), std::move(added), std::move(deleted), layout));
+}
+
+// Builds a score table (see build_score_table) from a Uint32Array holding a
+// score for each entry of a counted dawg, by index.
+NAN_METHOD(BuildScoreTable) {
+    if (info.Length() != 1 || !info[0]->IsUint32Array()) {
+        Nan::ThrowTypeError("first argument must be a Uint32Array");
+        return;
+    }
+
+    Nan::TypedArrayContents<uint32_t> scores(info[0]);
+    auto* output = new std::vector<unsigned char>();
+    build_score_table(*scores, static_cast<unsigned int>(scores.length()), output);
+
+    Nan::MaybeLocal<v8::Object> out = Nan::NewBuffer(
+        reinterpret_cast<char*>(&((*output)[0])),
+        output->size(),
+        free_dawg_vector,
+        output);
+    info.GetReturnValue().Set(out.ToLocalChecked());
+}
+
 static NAN_MODULE_INIT(Init) {
     JSDawg::Init(target);
     CompactDawg::Init(target);
     CompactIterator::Init(target);
+    CompactDawgSet::Init(target);
     Nan::SetMethod(target, "crc32c", Crc32c);
+    Nan::SetMethod(target, "crc32cAsync", Crc32cAsync);
+    Nan::SetMethod(target, "mapFile", MapFile);
+    Nan::SetMethod(target, "buildCompactDawgFromFile", BuildCompactDawgFromFile);
+    Nan::SetMethod(target, "buildScoreTable", BuildScoreTable);
+    Nan::SetMethod(target, "mergeCompactDawg", MergeCompactDawg);
 }
 
 NODE_MODULE(jsdawg, Init) // NOLINT
\ No newline at end of file
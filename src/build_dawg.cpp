@@ -1,16 +1,62 @@
 #include "builder.cpp"
+#include <cerrno>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <limits>
+
+// Parses a non-negative decimal argument; returns false if it isn't one.
+bool parse_argument(const char* argument, unsigned long* value) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long parsed = std::strtoul(argument, &end, 10);
+    if (end == argument || *end != '\0' || errno == ERANGE || argument[0] == '-') {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
+    if (argc < 3 || argc > 7) {
         std::cout << "Wrong number of arguments";
         return -1;
     }
 
+    // optional third argument: the format version to write
+    unsigned long version = DAWG_VERSION_INTERLEAVED_EDGES;
+    if (argc >= 4 && (!parse_argument(argv[3], &version) || version > DAWG_VERSION_TAILS || !supported_dawg_version(static_cast<unsigned int>(version)))) {
+        std::cout << "Unsupported version";
+        return -1;
+    }
+
+    // optional fourth argument: how many threads to build with. The default
+    // of one streams the input; more read it all into memory first
+    unsigned long threads = 1;
+    if (argc >= 5 && (!parse_argument(argv[4], &threads) || threads == 0 || threads > std::numeric_limits<unsigned int>::max())) {
+        std::cout << "Invalid number of threads";
+        return -1;
+    }
+
+    // optional fifth argument: megabytes of words to sort in memory at a
+    // time, for input that isn't sorted already
+    unsigned long sort_megabytes = 0;
+    if (argc >= 6 && (!parse_argument(argv[5], &sort_megabytes) || sort_megabytes > std::numeric_limits<std::size_t>::max() / (1024 * 1024))) {
+        std::cout << "Invalid sort memory";
+        return -1;
+    }
+    std::size_t sort_memory = sort_megabytes * 1024 * 1024;
+
+    // optional sixth argument: the directory to spill sorted runs to,
+    // defaulting to $TMPDIR or /tmp
+    std::string temp_dir = argc == 7 ? argv[6] : "";
+
     std::fstream infile, outfile;
     infile.open(argv[1], std::fstream::in);
     outfile.open(argv[2], std::fstream::out | std::fstream::binary);
 
-    build_compact_dawg_full(&infile, &outfile, true, EDGE_COUNT_ONLY);
+    if (!build_compact_dawg_full(&infile, &outfile, true, EDGE_COUNT_ONLY, static_cast<unsigned int>(version), DAWG_LAYOUT_DEPTH_FIRST, static_cast<unsigned int>(threads), sort_memory, temp_dir)) {
+        std::cout << "Could not build " << argv[1];
+        return -1;
+    }
 }
\ No newline at end of file
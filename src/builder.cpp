@@ -1,146 +1,424 @@
+#include "compact_dawg.hpp"
 #include "crc32c.hpp"
 #include "dawg.cpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <iostream>
+#include <iterator>
 #include <memory>
-#include <unordered_map>
+#include <queue>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
+using namespace dawgcache::detail;
+
+// a compact dawg header (see compact_dawg.hpp for the format), before the
+// version, sizes and checksum are filled in
+constexpr char DAWG_DEFAULT_HEADER[] = "dawg\x01\x01\x01\x04\0\0\0\0\0\0\0\0";
+
+// nodes are written in depth-first order, each node followed by the first
+// subtree below it
+const unsigned int DAWG_LAYOUT_DEPTH_FIRST = 0;
+// nodes near the root are written breadth-first, so the levels every lookup
+// passes through share cache lines, and the rest depth-first below them
+const unsigned int DAWG_LAYOUT_HYBRID = 1;
+
+// how many bytes of nodes the hybrid layout writes breadth-first; small
+// enough that the top of the dawg stays in L1 alongside the nodes below it
+const std::size_t HYBRID_LAYOUT_BREADTH_FIRST_BYTES = 16 * 1024;
+
+const unsigned int NODE_NOT_WRITTEN = 0xffffffff;
+
+// How the nodes of a compact dawg are encoded.
+struct node_encoding {
+    unsigned int node_size;
+    unsigned int version;
+    unsigned int offset_width;
+    // nodes folded into their parent's tail, indexed by node id; empty
+    // unless the version has tails
+    std::vector<unsigned char> tail_nodes;
+};
+
+// the number of bytes an unsigned LEB128 varint takes to store value
+inline std::size_t varint_size(unsigned int value) {
+    std::size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
 
-const unsigned int IS_FINAL_FLAG = 0x80000000;
-const unsigned int NOT_FINAL_FLAG = 0;
-const unsigned int FINAL_MASK = 0x7fffffff;
+inline unsigned char* write_varint(unsigned char* output, unsigned int value) {
+    while (value >= 0x80) {
+        *output++ = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+    *output++ = static_cast<unsigned char>(value);
+    return output;
+}
 
-const unsigned int DAWG_HEADER_SIZE = 16;
+// Marks the nodes that can be folded into a tail: non-final nodes with
+// edges whose only incoming edge comes from a node with no other edges.
+std::vector<unsigned char> find_tail_nodes(Dawg* dawg) {
+    std::vector<unsigned int> in_degree(dawg->nodes.size(), 0);
+    std::vector<unsigned char> only_child(dawg->nodes.size(), 0);
+    std::vector<unsigned char> visited(dawg->nodes.size(), 0);
+    std::vector<unsigned int> stack;
+    stack.push_back(dawg->root);
+    visited[dawg->root] = 1;
+
+    while (!stack.empty()) {
+        unsigned int node = stack.back();
+        stack.pop_back();
+        DawgEdgeRange edges = dawg->edges_of(node);
+        for (auto const& edge : edges) {
+            in_degree[edge.child]++;
+            if (edges.size() == 1) only_child[edge.child] = 1;
+            if (!visited[edge.child]) {
+                visited[edge.child] = 1;
+                stack.push_back(edge.child);
+            }
+        }
+    }
 
-const unsigned int EDGE_COUNT_ONLY = 1;
-const unsigned int INCLUDES_ENTRY_COUNT = 5;
+    std::vector<unsigned char> tail_nodes(dawg->nodes.size(), 0);
+    for (std::size_t node = 0; node < tail_nodes.size(); node++) {
+        if (in_degree[node] == 1 && only_child[node] && !dawg->nodes[node].final) {
+            tail_nodes[node] = 1;
+        }
+    }
+    return tail_nodes;
+}
+
+// Follows the chain of nodes folded into `node`'s tail, returning the last
+// of them, whose edges are written after the tail. The tail's letters are
+// copied to `letters` if it isn't null.
+unsigned int tail_end(Dawg* dawg, unsigned int node, node_encoding const& encoding, std::size_t* tail_length, unsigned char* letters = nullptr) {
+    *tail_length = 0;
+    if (encoding.tail_nodes.empty()) return node;
+
+    while (true) {
+        DawgEdgeRange edges = dawg->edges_of(node);
+        if (edges.size() != 1 || !encoding.tail_nodes[edges.first->child]) return node;
+        if (letters != nullptr) letters[*tail_length] = edges.first->letter;
+        (*tail_length)++;
+        node = edges.first->child;
+    }
+}
 
-/* header format 16 bytes, consisting of:
-    * the string "dawg" (4 bytes)
-    * version number (1 byte) - currently 1
-    * size in bytes of each character (1 byte) - currently always 1
-    * size in bytes of each node structure (1 byte):
-    *   either 1 byte if it's just an edge count
-    *   or 5 if it's an edge count (1 byte) and an entry count (4 bytes)
-    * size in bytes of each node offset (1 byte) - currently always 4
-    * size in bytes of the datastructure (does not include this header)
-    * the crc32c checksum of the datastructure (does not include this header)
-*/
-const char* DAWG_DEFAULT_HEADER = "dawg\x01\x01\x01\x04\0\0\0\0\0\0\0\0";
+std::size_t compact_node_bytes(Dawg* dawg, unsigned int node, node_encoding const& encoding) {
+    std::size_t tail_length;
+    unsigned int last = tail_end(dawg, node, encoding, &tail_length);
+    std::size_t edge_count = dawg->edges_of(last).size();
+    std::size_t ranks = encoding.node_size == INCLUDES_EDGE_RANKS ? edge_count * sizeof(unsigned int) : 0;
+    if (encoding.version < DAWG_VERSION_VARIABLE_WIDTH) {
+        return node_header_size(encoding.node_size) + (5 * edge_count) + ranks;
+    }
 
-void write_node(shared_ptr<DawgNode> node, std::vector<unsigned char>* output, std::vector<unsigned int>* edge_locs, std::unordered_map<unsigned int, unsigned int>* node_locs, unsigned int node_size) {
-    if (node_locs->count(node->id) > 0) {
-        // already visited
-        return;
+    std::size_t header;
+    if (encoding.version == DAWG_VERSION_TAILS) {
+        // the low bit of the edge count says whether there's a tail
+        header = varint_size(static_cast<unsigned int>((edge_count << 1) | (tail_length > 0 ? 1 : 0)));
+        if (tail_length > 0) {
+            header += varint_size(static_cast<unsigned int>(tail_length)) + tail_length;
+        }
+    } else {
+        header = varint_size(static_cast<unsigned int>(edge_count));
     }
+    if (has_entry_counts(encoding.node_size)) {
+        header += varint_size(dawg->nodes[node].count);
+    }
+    return header + (edge_count * (1 + encoding.offset_width)) + ranks;
+}
 
-    int offset = output->size();
-    (*node_locs)[node->id] = offset;
+// leaves don't get a node of their own unless they carry a count
+bool needs_compact_node(Dawg* dawg, unsigned int node, unsigned int node_size) {
+    return has_entry_counts(node_size) || dawg->edges_of(node).size() > 0;
+}
 
-    output->push_back(static_cast<unsigned char>(node->edges.size()));
-    if (node_size == INCLUDES_ENTRY_COUNT) {
-        int cur_size = output->size();
-        output->resize(cur_size + sizeof(unsigned int));
-        memcpy(&((*output)[cur_size]), &(node->count), sizeof(unsigned int));
+// Returns the nodes to write, in the order they should be written. Uses an
+// explicit stack rather than recursion so deep dawgs can't overflow the
+// call stack.
+std::vector<unsigned int> layout_nodes(Dawg* dawg, node_encoding const& encoding, unsigned int layout) {
+    unsigned int node_size = encoding.node_size;
+    enum : unsigned char { UNSEEN,
+                           QUEUED,
+                           PLACED };
+    std::vector<unsigned char> state(dawg->nodes.size(), UNSEEN);
+    std::vector<unsigned int> order;
+    std::vector<unsigned int> stack;
+
+    if (layout == DAWG_LAYOUT_HYBRID) {
+        std::vector<unsigned int> queue;
+        queue.push_back(dawg->root);
+        state[dawg->root] = QUEUED;
+
+        std::size_t head = 0;
+        std::size_t bytes = 0;
+        while (head < queue.size() && bytes < HYBRID_LAYOUT_BREADTH_FIRST_BYTES) {
+            unsigned int node = queue[head++];
+            state[node] = PLACED;
+            order.push_back(node);
+            bytes += compact_node_bytes(dawg, node, encoding);
+            std::size_t tail_length;
+            for (auto const& edge : dawg->edges_of(tail_end(dawg, node, encoding, &tail_length))) {
+                if (state[edge.child] == UNSEEN && needs_compact_node(dawg, edge.child, node_size)) {
+                    state[edge.child] = QUEUED;
+                    queue.push_back(edge.child);
+                }
+            }
+        }
+
+        // the rest of the frontier is written depth-first, in queue order
+        for (std::size_t i = queue.size(); i > head; i--) {
+            stack.push_back(queue[i - 1]);
+        }
+    } else {
+        stack.push_back(dawg->root);
     }
 
-    std::vector<std::shared_ptr<DawgNode>> nodes_to_process;
-    std::shared_ptr<DawgNode> child;
-    int i = 0;
-    for (auto const& edge : node->edges) {
-        char edge_key = edge.first;
-        child = edge.second;
+    while (!stack.empty()) {
+        unsigned int node = stack.back();
+        stack.pop_back();
+        if (state[node] == PLACED) continue;
+        state[node] = PLACED;
+        order.push_back(node);
+
+        // push children in reverse so the first one is written next
+        std::size_t tail_length;
+        DawgEdgeRange edges = dawg->edges_of(tail_end(dawg, node, encoding, &tail_length));
+        for (auto edge = edges.end(); edge != edges.begin();) {
+            --edge;
+            if (state[edge->child] != PLACED && needs_compact_node(dawg, edge->child, node_size)) {
+                stack.push_back(edge->child);
+            }
+        }
+    }
 
-        int edge_offset = (i * 5) + offset + node_size;
-        unsigned int node_id, flagged_id;
+    return order;
+}
 
-        if (child->edges.size() == 0 && node_size == EDGE_COUNT_ONLY) {
-            node_id = 0;
-        } else {
-            nodes_to_process.push_back(child);
-            node_id = child->id;
+void write_node(Dawg* dawg, unsigned int node, unsigned char* output, std::vector<unsigned int> const& node_locs, node_encoding const& encoding) {
+    std::size_t tail_length;
+    DawgEdgeRange edges = dawg->edges_of(tail_end(dawg, node, encoding, &tail_length));
+    int edge_count = static_cast<int>(edges.size());
+
+    unsigned char* edges_start;
+    if (encoding.version == DAWG_VERSION_TAILS) {
+        edges_start = write_varint(output, static_cast<unsigned int>((edge_count << 1) | (tail_length > 0 ? 1 : 0)));
+        if (has_entry_counts(encoding.node_size)) {
+            edges_start = write_varint(edges_start, dawg->nodes[node].count);
+        }
+        if (tail_length > 0) {
+            edges_start = write_varint(edges_start, static_cast<unsigned int>(tail_length));
+            tail_end(dawg, node, encoding, &tail_length, edges_start);
+            edges_start += tail_length;
+        }
+    } else if (encoding.version == DAWG_VERSION_VARIABLE_WIDTH) {
+        edges_start = write_varint(output, static_cast<unsigned int>(edge_count));
+        if (has_entry_counts(encoding.node_size)) {
+            edges_start = write_varint(edges_start, dawg->nodes[node].count);
         }
+    } else {
+        output[0] = static_cast<unsigned char>(edge_count);
+        if (has_entry_counts(encoding.node_size)) {
+            memcpy(output + 1, &(dawg->nodes[node].count), sizeof(unsigned int));
+        }
+        edges_start = output + node_header_size(encoding.node_size);
+    }
 
-        flagged_id = (node_id & FINAL_MASK) | (child->final ? IS_FINAL_FLAG : NOT_FINAL_FLAG);
+    unsigned char* ranks_start;
+    if (encoding.version == DAWG_VERSION_INTERLEAVED_EDGES) {
+        ranks_start = edges_start + (5 * edge_count);
+    } else {
+        ranks_start = edges_start + (edge_count * (1 + encoding.offset_width));
+    }
 
-        output->push_back(edge_key);
+    // offsets narrower than 4 bytes carry the final flag in their top bit
+    unsigned int final_flag = 1u << ((8 * encoding.offset_width) - 1);
+    unsigned int rank = 0;
+    int i = 0;
+    for (auto const& edge : edges) {
+        unsigned char* letter_loc;
+        unsigned char* offset_loc;
+        if (encoding.version == DAWG_VERSION_INTERLEAVED_EDGES) {
+            letter_loc = edges_start + (i * 5);
+            offset_loc = letter_loc + 1;
+        } else {
+            letter_loc = edges_start + i;
+            offset_loc = edges_start + edge_count + (i * encoding.offset_width);
+        }
+
+        // children without a node of their own are written as offset 0
+        unsigned int child_loc = node_locs[edge.child];
+        unsigned int offset = child_loc == NODE_NOT_WRITTEN ? 0 : child_loc;
+        unsigned int flagged_offset = (offset & (final_flag - 1)) | (dawg->nodes[edge.child].final ? final_flag : NOT_FINAL_FLAG);
 
-        int cur_size = output->size();
-        output->resize(cur_size + sizeof(unsigned int));
-        memcpy(&((*output)[cur_size]), &flagged_id, sizeof(unsigned int));
+        *letter_loc = edge.letter;
+        // offsets are little-endian, so narrow ones are a prefix of the
+        // 4-byte form
+        memcpy(offset_loc, &flagged_offset, encoding.offset_width);
 
-        edge_locs->push_back(edge_offset);
+        if (encoding.node_size == INCLUDES_EDGE_RANKS) {
+            rank += dawg->nodes[edge.child].count;
+            memcpy(ranks_start + (i * sizeof(unsigned int)), &rank, sizeof(unsigned int));
+        }
         i++;
     }
+}
 
-    size_t num_nodes = nodes_to_process.size();
-    for (size_t i = 0; i < num_nodes; i++) {
-        write_node(nodes_to_process[i], output, edge_locs, node_locs, node_size);
+// Assigns every node in `order` its offset from the start of the data,
+// returning the size of the data. Node sizes are known up front, so this
+// can happen before anything is written; node_locs is indexed by node id.
+std::size_t assign_node_locs(Dawg* dawg, std::vector<unsigned int> const& order, std::vector<unsigned int>* node_locs, node_encoding const& encoding) {
+    node_locs->assign(dawg->nodes.size(), NODE_NOT_WRITTEN);
+    std::size_t data_size = 0;
+    for (unsigned int node : order) {
+        (*node_locs)[node] = static_cast<unsigned int>(data_size);
+        data_size += compact_node_bytes(dawg, node, encoding);
     }
+    return data_size;
 }
 
-void build_compact_dawg(Dawg* dawg, std::vector<unsigned char>* output, bool verbose, unsigned int node_size) {
-    // write the header
-    output->resize(output->size() + DAWG_HEADER_SIZE);
-    memcpy(&((*output)[0]), DAWG_DEFAULT_HEADER, DAWG_HEADER_SIZE);
+// Lays the dawg out and assigns node offsets, picking the narrowest offsets
+// that can address the whole dawg from version 3. Returns the data size.
+std::size_t plan_compact_dawg(Dawg* dawg, unsigned int node_size, unsigned int version, unsigned int layout, node_encoding* encoding, std::vector<unsigned int>* order, std::vector<unsigned int>* node_locs) {
+    encoding->node_size = node_size;
+    encoding->version = version;
+    encoding->offset_width = sizeof(unsigned int);
+    if (version == DAWG_VERSION_TAILS) {
+        encoding->tail_nodes = find_tail_nodes(dawg);
+    }
+
+    *order = layout_nodes(dawg, *encoding, layout);
+    if (version >= DAWG_VERSION_VARIABLE_WIDTH) {
+        for (unsigned int width = 2; width < sizeof(unsigned int); width++) {
+            encoding->offset_width = width;
+            std::size_t data_size = assign_node_locs(dawg, *order, node_locs, *encoding);
+            // every node has to start below the final flag
+            if (data_size <= (std::size_t(1) << ((8 * width) - 1))) {
+                return data_size;
+            }
+        }
+        encoding->offset_width = sizeof(unsigned int);
+    }
+    return assign_node_locs(dawg, *order, node_locs, *encoding);
+}
 
-    std::vector<unsigned int> edge_locs;
+void write_header(unsigned char* header, node_encoding const& encoding, std::size_t data_size, unsigned int checksum) {
+    memcpy(header, DAWG_DEFAULT_HEADER, DAWG_HEADER_SIZE);
+    header[4] = static_cast<unsigned char>(encoding.version);
+    header[6] = static_cast<unsigned char>(encoding.node_size);
+    header[7] = static_cast<unsigned char>(encoding.offset_width);
 
-    // this maps from a dawgdic node index to an offset in the compressed DAWG
-    std::unordered_map<unsigned int, unsigned int> node_locs;
+    auto size = static_cast<unsigned int>(data_size);
+    memcpy(header + 8, &size, sizeof(unsigned int));
+    memcpy(header + 12, &checksum, sizeof(unsigned int));
+}
 
+void build_compact_dawg(Dawg* dawg, std::vector<unsigned char>* output, bool verbose, unsigned int node_size, unsigned int version = DAWG_VERSION_INTERLEAVED_EDGES, unsigned int layout = DAWG_LAYOUT_DEPTH_FIRST) {
     if (verbose) {
         cout << "Starting serialization...\n";
     }
 
-    write_node(dawg->root, output, &edge_locs, &node_locs, node_size);
+    node_encoding encoding{};
+    std::vector<unsigned int> order;
+    std::vector<unsigned int> node_locs;
+    std::size_t data_size = plan_compact_dawg(dawg, node_size, version, layout, &encoding, &order, &node_locs);
 
     if (verbose) {
-        cout << "Rewriting offsets...\n";
+        cout << "Writing nodes...\n";
     }
 
-    size_t num_edges = edge_locs.size();
-    for (size_t i = 0; i < num_edges; i++) {
-        unsigned int edge_offset = edge_locs[i];
+    std::size_t header_start = output->size();
+    output->resize(header_start + DAWG_HEADER_SIZE + data_size);
+    unsigned char* header = &((*output)[header_start]);
+    unsigned char* data = header + DAWG_HEADER_SIZE;
+    for (unsigned int node : order) {
+        write_node(dawg, node, data + node_locs[node], node_locs, encoding);
+    }
 
-        unsigned int flagged_id;
-        memcpy(&flagged_id, &((*output)[edge_offset + 1]), sizeof(unsigned int));
+    if (verbose) {
+        cout << "Rewriting metadata\n";
+    }
 
-        unsigned int node_id = flagged_id & FINAL_MASK;
+    write_header(header, encoding, data_size, crc32c(data, data_size));
 
-        if (node_id == 0) {
-            continue;
-        }
-
-        unsigned int adjusted_loc = node_locs[node_id] - DAWG_HEADER_SIZE;
+    if (verbose) {
+        cout << "Done; generated " << output->size() << " bytes of output\n";
+    }
+}
 
-        // copy the flag bit from node_id to the offset
-        int flagged_offset = (adjusted_loc & FINAL_MASK) | (flagged_id & IS_FINAL_FLAG);
+// nodes are buffered into chunks of about this size before being written out
+const std::size_t STREAM_CHUNK_BYTES = 1 << 20;
 
-        memcpy(&((*output)[edge_offset + 1]), &flagged_offset, sizeof(unsigned int));
+// Like build_compact_dawg, but writes nodes to `output_stream` as it goes
+// instead of building the whole image in memory. The header is written last,
+// once the checksum is known, so the stream has to be seekable. Returns false
+// if writing fails.
+bool write_compact_dawg(Dawg* dawg, std::ostream* output_stream, bool verbose, unsigned int node_size, unsigned int version = DAWG_VERSION_INTERLEAVED_EDGES, unsigned int layout = DAWG_LAYOUT_DEPTH_FIRST) {
+    if (verbose) {
+        cout << "Starting serialization...\n";
     }
 
+    node_encoding encoding{};
+    std::vector<unsigned int> order;
+    std::vector<unsigned int> node_locs;
+    std::size_t data_size = plan_compact_dawg(dawg, node_size, version, layout, &encoding, &order, &node_locs);
+
     if (verbose) {
-        cout << "Rewriting metadata\n";
+        cout << "Writing nodes...\n";
     }
 
-    (*output)[6] = static_cast<unsigned char>(node_size);
+    // reserve room for the header
+    std::ostream::pos_type header_pos = output_stream->tellp();
+    unsigned char header[DAWG_HEADER_SIZE] = {};
+    output_stream->write(reinterpret_cast<const char*>(header), DAWG_HEADER_SIZE);
+
+    // nodes are written in offset order, so each one can be appended to the
+    // current chunk
+    std::vector<unsigned char> chunk;
+    unsigned int checksum = 0;
+    for (unsigned int node : order) {
+        std::size_t at = chunk.size();
+        chunk.resize(at + compact_node_bytes(dawg, node, encoding));
+        write_node(dawg, node, &chunk[at], node_locs, encoding);
+
+        if (chunk.size() >= STREAM_CHUNK_BYTES) {
+            checksum = crc32c(chunk.data(), chunk.size(), checksum);
+            output_stream->write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+            chunk.clear();
+        }
+    }
+    checksum = crc32c(chunk.data(), chunk.size(), checksum);
+    output_stream->write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
 
-    unsigned int data_size = ((unsigned int)output->size()) - DAWG_HEADER_SIZE;
-    memcpy(&((*output)[8]), &data_size, sizeof(unsigned int));
+    if (verbose) {
+        cout << "Rewriting metadata\n";
+    }
 
-    unsigned int checksum = crc32c(&((*output)[DAWG_HEADER_SIZE]), data_size);
-    memcpy(&((*output)[12]), &checksum, sizeof(unsigned int));
+    write_header(header, encoding, data_size, checksum);
+    std::ostream::pos_type end_pos = output_stream->tellp();
+    output_stream->seekp(header_pos);
+    output_stream->write(reinterpret_cast<const char*>(header), DAWG_HEADER_SIZE);
+    output_stream->seekp(end_pos);
+    output_stream->flush();
 
     if (verbose) {
-        cout << "Done; generated " << output->size() << " bytes of output\n";
+        cout << "Done; generated " << (DAWG_HEADER_SIZE + data_size) << " bytes of output\n";
     }
+
+    return output_stream->good();
 }
 
-bool build_compact_dawg_full(std::istream* input_stream, std::ostream* output_stream, bool verbose, unsigned int node_size) {
-    Dawg dawg;
+// Reads sorted, newline-delimited words into `dawg` and finishes it; returns
+// false if they turn out not to be sorted.
+bool read_dawg(std::istream* input_stream, Dawg* dawg, bool verbose) {
     std::string word;
     int word_count = 0;
     time_t start = time(nullptr);
@@ -151,7 +429,7 @@ bool build_compact_dawg_full(std::istream* input_stream, std::ostream* output_st
         }
         word_count += 1;
 
-        if (!dawg.insert(word.data(), word.size())) return false;
+        if (!dawg->insert(word.data(), word.size())) return false;
 
         if (verbose && word_count % 100 == 0) {
             cout << word_count << "\r";
@@ -162,18 +440,423 @@ bool build_compact_dawg_full(std::istream* input_stream, std::ostream* output_st
         cout << "Finalizing structures...\n";
     }
 
-    dawg.finish();
+    dawg->finish();
+
+    if (verbose) {
+        cout << "Dawg creation took " << (time(nullptr) - start) << " s\n";
+        cout << "Read " << word_count << " words into " << dawg->node_count() << " nodes and " << dawg->edge_count() << " edges\n";
+    }
+
+    return true;
+}
+
+// how many shards per thread read_dawg_parallel aims for, so that threads
+// that finish early can pick up more of the work
+const unsigned int SHARDS_PER_THREAD = 4;
+
+// Like read_dawg, but builds shards of the words on `threads` threads and
+// merges them. The input is read into memory and split between lines where
+// the first byte changes, into shards of roughly equal size; each is built
+// into a dawg of its own, and the results are merged (see Dawg::merge),
+// which gives the same dawg as reading the words one by one. The input is
+// freed before merging, and each shard as soon as it's been merged.
+bool read_dawg_parallel(std::istream* input_stream, Dawg* dawg, bool verbose, unsigned int threads) {
+    if (threads <= 1) {
+        return read_dawg(input_stream, dawg, verbose);
+    }
+    time_t start = time(nullptr);
+
+    std::string input((std::istreambuf_iterator<char>(*input_stream)), std::istreambuf_iterator<char>());
+
+    // shards[i] is the offset of the first line of shard i; a shard ends
+    // where the next begins. Each boundary is the first line at least
+    // `target` bytes into the shard whose first byte differs from the
+    // non-empty lines before it, which only needs the lines around it read.
+    std::vector<std::size_t> shards(1, 0);
+    std::size_t target = input.size() / (static_cast<std::size_t>(threads) * SHARDS_PER_THREAD) + 1;
+    while (true) {
+        std::size_t newline = input.find('\n', shards.back() + target - 1);
+        if (newline == std::string::npos) {
+            break;
+        }
+        std::size_t line = newline + 1;
+        int first_byte = -1;
+        while (line < input.size()) {
+            std::size_t line_end = input.find('\n', line);
+            if (line_end == std::string::npos) {
+                line_end = input.size();
+            }
+            if (line_end > line) {
+                auto letter = static_cast<unsigned char>(input[line]);
+                if (first_byte == -1) {
+                    first_byte = letter;
+                } else if (letter != first_byte) {
+                    break;
+                }
+            }
+            line = line_end + 1;
+        }
+        if (line >= input.size()) {
+            break;
+        }
+        // the shards have to be in order too, which their first bytes decide
+        if (static_cast<unsigned char>(input[line]) < first_byte) {
+            return false;
+        }
+        shards.push_back(line);
+    }
+    shards.push_back(input.size());
+
+    std::size_t shard_count = shards.size() - 1;
+    std::vector<std::unique_ptr<Dawg>> shard_dawgs(shard_count);
+    std::vector<unsigned char> sorted(shard_count, 1);
+    std::vector<std::size_t> word_counts(shard_count, 0);
+    std::atomic<std::size_t> next_shard(0);
+    auto build_shards = [&]() {
+        for (std::size_t shard = next_shard++; shard < shard_count; shard = next_shard++) {
+            shard_dawgs[shard].reset(new Dawg());
+            std::size_t line = shards[shard];
+            while (line < shards[shard + 1]) {
+                std::size_t line_end = std::min(input.find('\n', line), shards[shard + 1]);
+                if (line_end > line) {
+                    word_counts[shard]++;
+                    if (!shard_dawgs[shard]->insert(&input[line], line_end - line)) {
+                        sorted[shard] = 0;
+                        break;
+                    }
+                }
+                line = line_end + 1;
+            }
+            shard_dawgs[shard]->finish();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threads && i < shard_count; i++) {
+        workers.emplace_back(build_shards);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::size_t word_count = 0;
+    for (std::size_t shard = 0; shard < shard_count; shard++) {
+        if (sorted[shard] == 0) {
+            return false;
+        }
+        word_count += word_counts[shard];
+    }
+    input.clear();
+    input.shrink_to_fit();
+
+    if (verbose) {
+        cout << "Built " << shard_count << " shards on " << workers.size() << " threads, merging...\n";
+    }
+    dawg->merge(&shard_dawgs);
+
+    if (verbose) {
+        cout << "Dawg creation took " << (time(nullptr) - start) << " s\n";
+        cout << "Read " << word_count << " words into " << dawg->node_count() << " nodes and " << dawg->edge_count() << " edges\n";
+    }
+
+    return true;
+}
+
+// how many bytes at a time a spilled sort run is read back in
+const std::size_t SORT_RUN_BUFFER_SIZE = 1 << 16;
+
+// One sorted, deduplicated run of words for read_dawg_unsorted to merge:
+// either a temporary file of newline-terminated words, or (for the last
+// run, which is never spilled) the words still in memory.
+struct sort_run {
+    FILE* file;
+    std::vector<std::string>* words;
+    std::size_t next_word;
+    std::vector<char> buffer;
+    std::size_t position;
+    std::size_t end;
+    // the run's current word
+    std::string word;
+
+    // moves on to the run's next word; returns false once it's exhausted
+    bool advance() {
+        if (file == nullptr) {
+            if (next_word == words->size()) return false;
+            word = std::move((*words)[next_word++]);
+            return true;
+        }
+
+        word.clear();
+        while (true) {
+            if (position == end) {
+                end = fread(buffer.data(), 1, buffer.size(), file);
+                position = 0;
+                if (end == 0) return false;
+            }
+            const char* from = buffer.data() + position;
+            const void* newline = memchr(from, '\n', end - position);
+            if (newline != nullptr) {
+                std::size_t length = static_cast<std::size_t>(static_cast<const char*>(newline) - from);
+                word.append(from, length);
+                position += length + 1;
+                return true;
+            }
+            word.append(from, end - position);
+            position = end;
+        }
+    }
+};
+
+void sort_unique_words(std::vector<std::string>* words) {
+    std::sort(words->begin(), words->end());
+    words->erase(std::unique(words->begin(), words->end()), words->end());
+}
+
+// how many spilled runs of one size read_dawg_unsorted lets pile up before
+// merging them into a single run of the next size up
+const std::size_t SORT_RUN_FAN_IN = 64;
+
+// Opens a new temporary file for a sorted run in `temp_dir`, or if that's
+// empty in $TMPDIR, falling back to /tmp. The file is unlinked straight
+// away, so it's removed once closed, even if the build dies.
+FILE* open_sort_run(std::string const& temp_dir) {
+    std::string dir = temp_dir;
+    if (dir.empty()) {
+        const char* env_dir = std::getenv("TMPDIR");
+        dir = env_dir != nullptr && env_dir[0] != '\0' ? env_dir : "/tmp";
+    }
+    std::string path = dir + "/dawg-sort-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1) return nullptr;
+    unlink(path.c_str());
+
+    FILE* file = fdopen(fd, "w+b");
+    if (file == nullptr) close(fd);
+    return file;
+}
+
+// Writes sorted words out to a new temporary file in `temp_dir` (see
+// open_sort_run), which is added to `runs` even if writing fails so that
+// the caller can close it.
+bool spill_sort_run(std::vector<std::string> const& words, std::string const& temp_dir, std::vector<FILE*>* runs) {
+    FILE* file = open_sort_run(temp_dir);
+    if (file == nullptr) return false;
+    runs->push_back(file);
+
+    for (auto const& word : words) {
+        fwrite(word.data(), 1, word.size(), file);
+        fputc('\n', file);
+    }
+    if (fflush(file) != 0 || ferror(file)) return false;
+    rewind(file);
+    return true;
+}
+
+// Merges spilled runs and the sorted words still in memory, handing each
+// distinct word to `emit` in order. Closes the spilled runs; returns false
+// if any of them couldn't be read back.
+template <typename Emit>
+bool merge_sort_runs(std::vector<FILE*>* spilled, std::vector<std::string>* words, Emit emit) {
+    std::vector<sort_run> runs(spilled->size() + 1);
+    for (std::size_t i = 0; i < runs.size(); i++) {
+        runs[i].file = i < spilled->size() ? (*spilled)[i] : nullptr;
+        runs[i].words = words;
+        runs[i].next_word = 0;
+        if (runs[i].file != nullptr) {
+            runs[i].buffer.resize(SORT_RUN_BUFFER_SIZE);
+        }
+        runs[i].position = 0;
+        runs[i].end = 0;
+    }
+
+    // the runs with words left, smallest current word on top
+    auto later = [&runs](std::size_t a, std::size_t b) { return runs[a].word > runs[b].word; };
+    std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> heads(later);
+    for (std::size_t i = 0; i < runs.size(); i++) {
+        if (runs[i].advance()) heads.push(i);
+    }
+
+    // a word can still turn up in several runs
+    std::string previous;
+    bool first = true;
+    while (!heads.empty()) {
+        std::size_t i = heads.top();
+        heads.pop();
+        if (first || runs[i].word != previous) {
+            emit(runs[i].word);
+            previous = runs[i].word;
+            first = false;
+        }
+        if (runs[i].advance()) heads.push(i);
+    }
+
+    bool ok = true;
+    for (FILE* file : *spilled) {
+        if (ferror(file)) ok = false;
+        fclose(file);
+    }
+    spilled->clear();
+    words->clear();
+    return ok;
+}
+
+// Like read_dawg, but for words in any order and with duplicates. Words are
+// collected until they take up about `memory_budget` bytes, then sorted,
+// deduplicated and spilled to a temporary file in `temp_dir` as a run (see
+// open_sort_run); once the input is exhausted the runs and the words left in
+// memory are merged straight into the dawg. Returns false if a run can't be
+// written or read back.
+bool read_dawg_unsorted(std::istream* input_stream, Dawg* dawg, bool verbose, std::size_t memory_budget, std::string const& temp_dir) {
+    std::string word;
+    int word_count = 0;
+    time_t start = time(nullptr);
+
+    std::vector<std::string> words;
+    std::size_t words_size = 0;
+    // levels[i] holds runs that each merge SORT_RUN_FAN_IN^i spills
+    std::vector<std::vector<FILE*>> levels(1);
+    std::size_t spill_count = 0;
+    bool ok = true;
+
+    while (ok && std::getline(*input_stream, word)) {
+        if (word.empty()) {
+            continue;
+        }
+        word_count += 1;
+
+        words_size += word.size() + sizeof(std::string);
+        words.push_back(std::move(word));
+        if (words_size < memory_budget) {
+            continue;
+        }
+
+        sort_unique_words(&words);
+        ok = spill_sort_run(words, temp_dir, &levels[0]);
+        words.clear();
+        words_size = 0;
+        spill_count += 1;
+        if (verbose) {
+            cout << "Spilled run " << spill_count << " after " << word_count << " words\n";
+        }
+
+        // keep the number of open runs down, rewriting each word at most
+        // once per level
+        for (std::size_t level = 0; ok && levels[level].size() == SORT_RUN_FAN_IN; level++) {
+            if (level + 1 == levels.size()) {
+                levels.emplace_back();
+            }
+            FILE* file = open_sort_run(temp_dir);
+            if (file == nullptr) {
+                ok = false;
+                break;
+            }
+            levels[level + 1].push_back(file);
+            std::vector<std::string> none;
+            ok = merge_sort_runs(&levels[level], &none, [file](std::string const& w) {
+                fwrite(w.data(), 1, w.size(), file);
+                fputc('\n', file);
+            });
+            ok = ok && fflush(file) == 0 && !ferror(file);
+            rewind(file);
+        }
+    }
+    sort_unique_words(&words);
+
+    std::vector<FILE*> spilled;
+    for (auto const& level : levels) {
+        spilled.insert(spilled.end(), level.begin(), level.end());
+    }
+    if (ok) {
+        if (verbose && !spilled.empty()) {
+            cout << "Merging " << (spilled.size() + 1) << " runs...\n";
+        }
+        ok = merge_sort_runs(&spilled, &words, [dawg](std::string const& w) {
+            dawg->insert(w.data(), w.size());
+        });
+    }
+    for (FILE* file : spilled) {
+        fclose(file);
+    }
+    if (!ok) return false;
+
+    if (verbose) {
+        cout << "Finalizing structures...\n";
+    }
+
+    dawg->finish();
 
     if (verbose) {
         cout << "Dawg creation took " << (time(nullptr) - start) << " s\n";
-        cout << "Read " << word_count << " words into " << dawg.node_count() << " nodes and " << dawg.edge_count() << " edges\n";
+        cout << "Read " << word_count << " words into " << dawg->node_count() << " nodes and " << dawg->edge_count() << " edges\n";
     }
 
-    std::vector<unsigned char> output;
+    return true;
+}
 
-    build_compact_dawg(&dawg, &output, verbose, node_size);
+// Reads words into `dawg` for the compact dawg builders: sorted words on up
+// to `threads` threads, or, if `sort_memory` isn't 0, words in any order,
+// sorted in runs of about that many bytes spilled to `temp_dir` (in which
+// case `threads` is ignored).
+bool read_dawg_input(std::istream* input_stream, Dawg* dawg, bool verbose, unsigned int threads, std::size_t sort_memory, std::string const& temp_dir = "") {
+    if (sort_memory > 0) {
+        return read_dawg_unsorted(input_stream, dawg, verbose, sort_memory, temp_dir);
+    }
+    return read_dawg_parallel(input_stream, dawg, verbose, threads);
+}
 
-    output_stream->write((const char*)&output[0], output.size());
+// Builds a compact dawg from newline-delimited words, read as in
+// read_dawg_input; returns false if they turn out not to be sorted (or
+// can't be sorted).
+bool build_compact_dawg_from_stream(std::istream* input_stream, std::vector<unsigned char>* output, bool verbose, unsigned int node_size, unsigned int version = DAWG_VERSION_INTERLEAVED_EDGES, unsigned int layout = DAWG_LAYOUT_DEPTH_FIRST, unsigned int threads = 1, std::size_t sort_memory = 0, std::string const& temp_dir = "") {
+    Dawg dawg;
+    if (!read_dawg_input(input_stream, &dawg, verbose, threads, sort_memory, temp_dir)) return false;
+
+    build_compact_dawg(&dawg, output, verbose, node_size, version, layout);
 
     return true;
-}
\ No newline at end of file
+}
+
+// Builds a compact dawg from newline-delimited words, read as in
+// read_dawg_input, straight into a seekable output stream; returns false if
+// the words turn out not to be sorted (or can't be sorted) or the output
+// can't be written.
+bool build_compact_dawg_full(std::istream* input_stream, std::ostream* output_stream, bool verbose, unsigned int node_size, unsigned int version = DAWG_VERSION_INTERLEAVED_EDGES, unsigned int layout = DAWG_LAYOUT_DEPTH_FIRST, unsigned int threads = 1, std::size_t sort_memory = 0, std::string const& temp_dir = "") {
+    Dawg dawg;
+    if (!read_dawg_input(input_stream, &dawg, verbose, threads, sort_memory, temp_dir)) return false;
+
+    return write_compact_dawg(&dawg, output_stream, verbose, node_size, version, layout);
+}
+
+// Score tables hold a score for each entry of a counted dawg, by index, for
+// ranking completions. The entries below any node of a counted dawg have
+// consecutive indexes, so the best score below a node is the maximum over a
+// range of the table; since nodes are shared between many words, that can't
+// be stored in the nodes themselves. Instead the scores are followed by a
+// max tree over blocks of them (see SCORE_TABLE_HEADER_SIZE in
+// compact_dawg.hpp).
+void build_score_table(const unsigned int* scores, unsigned int count, std::vector<unsigned char>* output) {
+    unsigned int blocks = (count + SCORE_BLOCK_SIZE - 1) / SCORE_BLOCK_SIZE;
+    unsigned int leaves = 1;
+    while (leaves < blocks) {
+        leaves <<= 1;
+    }
+
+    std::vector<unsigned int> tree(2 * static_cast<std::size_t>(leaves), 0);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int& block_max = tree[leaves + (i / SCORE_BLOCK_SIZE)];
+        block_max = std::max(block_max, scores[i]);
+    }
+    for (unsigned int i = leaves - 1; i > 0; i--) {
+        tree[i] = std::max(tree[2 * i], tree[(2 * i) + 1]);
+    }
+
+    output->assign(SCORE_TABLE_HEADER_SIZE + (sizeof(unsigned int) * (count + tree.size())), 0);
+    unsigned char* header = output->data();
+    memcpy(header, SCORE_TABLE_MAGIC, 4);
+    memcpy(header + 4, &count, sizeof(unsigned int));
+    memcpy(header + 8, &leaves, sizeof(unsigned int));
+    unsigned char* body = header + SCORE_TABLE_HEADER_SIZE;
+    if (count > 0) {
+        memcpy(body, scores, sizeof(unsigned int) * count);
+    }
+    memcpy(body + (sizeof(unsigned int) * count), tree.data(), sizeof(unsigned int) * tree.size());
+}
@@ -0,0 +1,1141 @@
+#include "compact_dawg.hpp"
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace dawgcache {
+namespace detail {
+
+namespace {
+
+inline unsigned int read_varint(const unsigned char** input) {
+    const unsigned char* p = *input;
+    if (*p < 0x80) {
+        // most counts fit in one byte
+        *input = p + 1;
+        return *p;
+    }
+
+    unsigned int value = 0;
+    unsigned int shift = 0;
+    while ((*p & 0x80) != 0) {
+        value |= static_cast<unsigned int>(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= static_cast<unsigned int>(*p++) << shift;
+    *input = p;
+    return value;
+}
+
+// A decoded view of one node of a compact dawg. Version 1 dawgs interleave
+// each edge's letter with its 4-byte flagged offset; version 2 dawgs store a
+// node's letters contiguously, followed by its offsets, so the letters can
+// be searched with vector compares. Version 3 dawgs are laid out like
+// version 2 behind varint counts, with offsets of target_width bytes, and
+// version 4 nodes may also start with a tail: a run of letters, each leading
+// to a single, non-final child, that has to be matched before the edges.
+struct compact_node {
+    const unsigned char* letters;
+    const unsigned char* targets;
+    const unsigned char* tail;
+    unsigned int edge_count;
+    unsigned int letter_stride;
+    unsigned int target_stride;
+    unsigned int target_width;
+    unsigned int tail_length;
+    // running totals of the entries below each edge, in INCLUDES_EDGE_RANKS
+    // dawgs
+    const unsigned char* ranks;
+
+    // the number of entries below edges 0 to i
+    unsigned int rank(unsigned int i) const {
+        unsigned int value;
+        memcpy(&value, ranks + (i * sizeof(unsigned int)), sizeof(unsigned int));
+        return value;
+    }
+
+    // the number of entries below the edges before edge i
+    unsigned int rank_before(unsigned int i) const { return i == 0 ? 0 : rank(i - 1); }
+
+    // returns the edge whose entries include the n-th entry below this node
+    // (counting from 1), or edge_count if there aren't that many
+    unsigned int find_rank(unsigned int n) const {
+        unsigned int min = 0, max = edge_count;
+        while (min < max) {
+            unsigned int guess = (min + max) >> 1;
+            if (rank(guess) < n) {
+                min = guess + 1;
+            } else {
+                max = guess;
+            }
+        }
+        return min;
+    }
+
+    // Matches as much of the tail as is left of key, advancing *depth past
+    // it. Returns false if they differ.
+    bool match_tail(const unsigned char* key, std::size_t key_length, std::size_t* depth) const {
+        if (tail_length == 0) return true;
+        std::size_t run = std::min(static_cast<std::size_t>(tail_length), key_length - *depth);
+        if (memcmp(tail, key + *depth, run) != 0) return false;
+        *depth += run;
+        return true;
+    }
+
+    unsigned char letter(unsigned int i) const { return letters[i * letter_stride]; }
+
+    // returns the i-th offset in 32-bit flagged form, whatever its width
+    unsigned int flagged_target(unsigned int i) const {
+        const unsigned char* target = targets + (i * target_stride);
+        unsigned int flagged_offset;
+        unsigned int final_flag;
+        // narrow offsets are little-endian with the final flag in their top bit
+        switch (target_width) {
+        case 2:
+            flagged_offset = target[0] | (target[1] << 8);
+            final_flag = 0x8000;
+            break;
+        case 3:
+            flagged_offset = target[0] | (target[1] << 8) | (target[2] << 16);
+            final_flag = 0x800000;
+            break;
+        default:
+            memcpy(&flagged_offset, target, sizeof(unsigned int));
+            return flagged_offset;
+        }
+        return (flagged_offset & (final_flag - 1)) | ((flagged_offset & final_flag) != 0u ? IS_FINAL_FLAG : NOT_FINAL_FLAG);
+    }
+
+    // returns the index of the edge for search_letter, or -1 if there isn't one
+    int find(unsigned char search_letter) const {
+        if (letter_stride == 1) {
+            // contiguous letters: compare a vector's worth at a time, and
+            // stop early once we're past search_letter since they're sorted
+            unsigned int i = 0;
+#if defined(__AVX2__)
+            __m256i needle32 = _mm256_set1_epi8(static_cast<char>(search_letter));
+            for (; i + 32 <= edge_count; i += 32) {
+                __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(letters + i));
+                auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32)));
+                if (mask != 0) return static_cast<int>(i + __builtin_ctz(mask));
+                if (letters[i + 31] > search_letter) return -1;
+            }
+#endif
+#if defined(__SSE2__)
+            __m128i needle16 = _mm_set1_epi8(static_cast<char>(search_letter));
+            for (; i + 16 <= edge_count; i += 16) {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(letters + i));
+                auto mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16)));
+                if (mask != 0) return static_cast<int>(i + __builtin_ctz(mask));
+                if (letters[i + 15] > search_letter) return -1;
+            }
+#endif
+            for (; i < edge_count; i++) {
+                if (letters[i] == search_letter) return static_cast<int>(i);
+                if (letters[i] > search_letter) return -1;
+            }
+            return -1;
+        }
+
+        // interleaved letters: binary search over the node edges
+        int min = 0, max = static_cast<int>(edge_count) - 1, guess = 0;
+        unsigned char letter;
+
+        while (min <= max) {
+            guess = (min + max) >> 1;
+            letter = letters[guess * letter_stride];
+            if (letter == search_letter) {
+                return guess;
+            }
+
+            if (letter < search_letter) {
+                min = guess + 1;
+            } else {
+                max = guess - 1;
+            }
+        }
+        return -1;
+    }
+};
+
+inline compact_node read_compact_node(compact_format const& format, const unsigned char* data, int node_offset) {
+    compact_node node{};
+    const unsigned char* edges_end;
+    if (format.version >= DAWG_VERSION_VARIABLE_WIDTH) {
+        const unsigned char* p = data + node_offset;
+        unsigned int header = read_varint(&p);
+        bool has_tail = false;
+        if (format.version == DAWG_VERSION_TAILS) {
+            // the low bit of the edge count says whether there's a tail
+            has_tail = (header & 1) != 0;
+            header >>= 1;
+        }
+        node.edge_count = header;
+        if (has_entry_counts(format.node_size)) {
+            read_varint(&p);
+        }
+        if (has_tail) {
+            node.tail_length = read_varint(&p);
+            node.tail = p;
+            p += node.tail_length;
+        }
+        node.letters = p;
+        node.targets = node.letters + node.edge_count;
+        node.letter_stride = 1;
+        node.target_stride = format.offset_width;
+        node.target_width = format.offset_width;
+        edges_end = node.targets + (node.edge_count * format.offset_width);
+    } else {
+        node.edge_count = data[node_offset];
+        node.letters = data + node_offset + node_header_size(format.node_size);
+        node.target_width = sizeof(unsigned int);
+        if (format.version == DAWG_VERSION_SPLIT_EDGES) {
+            node.targets = node.letters + node.edge_count;
+            node.letter_stride = 1;
+            node.target_stride = sizeof(unsigned int);
+        } else {
+            node.targets = node.letters + 1;
+            node.letter_stride = 5;
+            node.target_stride = 5;
+        }
+        edges_end = node.letters + (5 * node.edge_count);
+    }
+
+    if (format.node_size == INCLUDES_EDGE_RANKS) {
+        node.ranks = edges_end;
+    }
+    return node;
+}
+
+} // namespace
+
+int compact_entry_count(compact_format const& format, const unsigned char* data, int node_offset) {
+    if (format.version >= DAWG_VERSION_VARIABLE_WIDTH) {
+        const unsigned char* p = data + node_offset;
+        read_varint(&p);
+        return static_cast<int>(read_varint(&p));
+    }
+
+    int entry_count;
+    memcpy(&entry_count, &(data[node_offset + 1]), sizeof(int32_t));
+    return entry_count;
+}
+
+dawg_search_result compact_dawg_search(compact_format const& format, const unsigned char* data, const unsigned char* search, size_t search_length) {
+    unsigned int flagged_offset, node_final = 0;
+    int node_offset = 0, edge = 0;
+
+    unsigned int tail_index = 0;
+
+    dawg_search_result output;
+
+    for (size_t i = 0; i < search_length; i++) {
+        if (node_offset == -1) {
+            return output;
+        }
+
+        compact_node node = read_compact_node(format, data, node_offset);
+        if (node.tail_length > 0) {
+            std::size_t depth = i;
+            if (!node.match_tail(search, search_length, &depth)) {
+                return output;
+            }
+            // nothing along a tail is final
+            node_final = 0;
+            if (depth == search_length) {
+                tail_index = static_cast<unsigned int>(depth - i);
+                break;
+            }
+            i = depth;
+        }
+
+        edge = node.find(search[i]);
+        if (edge == -1) {
+            return output;
+        }
+
+        flagged_offset = node.flagged_target(edge);
+
+        node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+        node_final = flagged_offset & IS_FINAL_FLAG;
+
+        if (node_offset == 0) {
+            node_offset = -1;
+        }
+    }
+
+    output.node_offset = node_offset;
+    output.tail_index = tail_index;
+    output.found = true;
+    output.final = (node_final != 0u);
+    output.skipped = -1;
+    output.child_count = -1;
+    output.match_string = nullptr;
+    return output;
+}
+
+namespace {
+
+// the progress of one key through compact_dawg_search_many
+struct search_lane {
+    std::size_t key;
+    std::size_t depth;
+    int node_offset;
+    bool final;
+};
+
+// number of keys compact_dawg_search_many keeps in flight
+constexpr std::size_t SEARCH_LANES = 16;
+
+// Advances a search by the tail of the node it's at, if any, and one edge.
+// Returns 0 (not found), 1 (found as a prefix) or 2 (found as a word) once
+// the search is over, or -1 if it goes on, in which case the node it goes
+// on to is prefetched.
+inline int compact_search_step(compact_format const& format, const unsigned char* data, const unsigned char* key, std::size_t key_length, search_lane* lane) {
+    if (lane->node_offset == -1) {
+        return 0;
+    }
+
+    compact_node node = read_compact_node(format, data, lane->node_offset);
+    if (!node.match_tail(key, key_length, &lane->depth)) {
+        return 0;
+    }
+    if (lane->depth == key_length) {
+        // the key ended along the tail, where nothing is final
+        return 1;
+    }
+
+    int edge = node.find(key[lane->depth]);
+    if (edge == -1) {
+        return 0;
+    }
+
+    unsigned int flagged_offset = node.flagged_target(edge);
+    lane->node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+    lane->final = (flagged_offset & IS_FINAL_FLAG) != 0u;
+    if (lane->node_offset == 0) {
+        lane->node_offset = -1;
+    }
+    lane->depth++;
+
+    if (lane->depth == key_length) {
+        return lane->final ? 2 : 1;
+    }
+    if (lane->node_offset != -1) {
+        // the edge count and the first edges of the next node
+        __builtin_prefetch(data + lane->node_offset);
+        __builtin_prefetch(data + lane->node_offset + 64);
+    }
+    return -1;
+}
+
+} // namespace
+
+void compact_dawg_search_many(compact_format const& format, const unsigned char* data, const unsigned char* base, const search_key* keys, std::size_t num_keys, unsigned char* results) {
+    search_lane lanes[SEARCH_LANES];
+    std::size_t active = 0, next_key = 0;
+
+    while (active > 0 || next_key < num_keys) {
+        // top up the lanes; empty keys are prefixes of everything
+        while (active < SEARCH_LANES && next_key < num_keys) {
+            if (keys[next_key].length == 0) {
+                results[next_key++] = 1;
+                continue;
+            }
+            lanes[active++] = {next_key++, 0, 0, false};
+        }
+
+        std::size_t lane_idx = 0;
+        while (lane_idx < active) {
+            search_lane& lane = lanes[lane_idx];
+            search_key const& key = keys[lane.key];
+            int result = compact_search_step(format, data, base + key.offset, key.length, &lane);
+
+            if (result != -1) {
+                results[lane.key] = static_cast<unsigned char>(result);
+                // the last lane takes this one's place and is handled next
+                lanes[lane_idx] = lanes[--active];
+            } else {
+                lane_idx++;
+            }
+        }
+    }
+}
+
+unsigned int compact_dawg_set_search(dawg_set_member const* members, std::size_t num_members, const unsigned char* key, std::size_t key_length, bool prefix) {
+    unsigned int all = num_members == MAX_DAWG_SET_SIZE ? 0xffffffffu : (1u << num_members) - 1;
+    if (key_length == 0) {
+        // the empty key is a prefix of everything
+        return prefix ? all : 0;
+    }
+
+    search_lane lanes[MAX_DAWG_SET_SIZE];
+    std::size_t active = num_members;
+    for (std::size_t i = 0; i < num_members; i++) {
+        lanes[i] = {i, 0, 0, false};
+    }
+
+    unsigned int mask = 0;
+    while (active > 0) {
+        std::size_t lane_idx = 0;
+        while (lane_idx < active) {
+            search_lane& lane = lanes[lane_idx];
+            dawg_set_member const& member = members[lane.key];
+            int result = compact_search_step(member.format, member.data, key, key_length, &lane);
+
+            if (result == -1) {
+                lane_idx++;
+                continue;
+            }
+            if (result == 2 || (prefix && result == 1)) {
+                mask |= 1u << lane.key;
+            }
+            lanes[lane_idx] = lanes[--active];
+        }
+    }
+    return mask;
+}
+
+dawg_search_result counted_compact_dawg_search(compact_format const& format, const unsigned char* data, const unsigned char* search, size_t search_length) {
+    unsigned int flagged_offset, node_final = 0, tmp_final = 0;
+    int node_offset = 0, tmp_offset = 0, skipped = 0, skip_count = 0, edge = 0;
+    bool match = false;
+    unsigned char search_letter, letter;
+    compact_node node{};
+
+    dawg_search_result output;
+
+    for (size_t i = 0; i < search_length; i++) {
+        // linear search over the node edges, counting the entries we skip
+        match = false; // NOLINT (clang tidy thinks it is not used but it is)
+        search_letter = search[i];
+
+        if (node_offset != -1) {
+            node = read_compact_node(format, data, node_offset);
+
+            if (node.tail_length > 0) {
+                if (!node.match_tail(search, search_length, &i)) {
+                    return output;
+                }
+                // nothing along a tail is final, so below it are all the
+                // node's entries but the node itself
+                skip_count = compact_entry_count(format, data, node_offset) - (node_final != 0u ? 1 : 0);
+                node_final = 0;
+                if (i == search_length) {
+                    break;
+                }
+                search_letter = search[i];
+            }
+
+            if (node.ranks != nullptr) {
+                // the ranks count the entries we skip without visiting the
+                // siblings, so the edge can be found like an uncounted one
+                edge = node.find(search_letter);
+                if (edge != -1) {
+                    match = true;
+                    skipped += static_cast<int>(node.rank_before(static_cast<unsigned int>(edge)));
+                }
+            } else {
+                for (edge = 0; edge < static_cast<int>(node.edge_count); edge++) {
+                    letter = node.letter(edge);
+                    if (letter == search_letter) {
+                        match = true;
+                        break;
+                    }
+                    if (letter > search_letter) {
+                        break;
+                    }
+
+                    // peek into the node we didn't end up taking to determine the skip count
+                    flagged_offset = node.flagged_target(edge);
+
+                    tmp_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+                    tmp_final = flagged_offset & IS_FINAL_FLAG;
+
+                    if (tmp_offset == 0 || static_cast<int>(data[tmp_offset]) == 0) {
+                        if (tmp_final != 0u) {
+                            skipped += 1;
+                        }
+                    } else {
+                        skipped += compact_entry_count(format, data, tmp_offset);
+                    }
+                }
+            }
+        }
+        if (match) {
+            flagged_offset = node.flagged_target(edge);
+
+            node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+            node_final = flagged_offset & IS_FINAL_FLAG;
+
+            if (node.ranks != nullptr) {
+                skip_count = static_cast<int>(node.rank(static_cast<unsigned int>(edge)) - node.rank_before(static_cast<unsigned int>(edge)));
+            } else if (node_offset > 0) {
+                skip_count = compact_entry_count(format, data, node_offset);
+            } else {
+                skip_count = 0;
+            }
+            if (node_final != 0u) {
+                skipped += 1;
+            }
+
+            if (node_offset == 0) {
+                node_offset = -1;
+            }
+        } else {
+            return output;
+        }
+    }
+
+    output.node_offset = node_offset;
+    output.found = true;
+    output.final = (node_final != 0u);
+    output.child_count = skip_count;
+    output.skipped = node_final != 0u ? skipped - 1 : skipped;
+    output.match_string = nullptr;
+    return output;
+}
+
+dawg_search_result inverse_compact_dawg_search(compact_format const& format, const unsigned char* data, int index) {
+    unsigned int flagged_offset, node_final = 0;
+    int node_offset = 0, tmp_offset = 0, skip_count = 0;
+    unsigned int edge = 0;
+    compact_node node{};
+    std::string match_string;
+
+    dawg_search_result output;
+    int remaining = index + 1;
+    if (index < 0) {
+        return output;
+    }
+
+    while (true) {
+        if (node_offset == -1) {
+            // ran out of nodes; the index is out of range
+            return output;
+        }
+
+        node = read_compact_node(format, data, node_offset);
+        match_string.append(reinterpret_cast<const char*>(node.tail), node.tail_length);
+
+        if (node.ranks != nullptr) {
+            // binary search the ranks for the edge holding the entry
+            edge = node.find_rank(static_cast<unsigned int>(remaining));
+            if (edge < node.edge_count) {
+                skip_count = static_cast<int>(node.rank(edge) - node.rank_before(edge));
+                remaining -= static_cast<int>(node.rank_before(edge));
+                match_string += node.letter(edge);
+            }
+        } else {
+            for (edge = 0; edge < node.edge_count; edge++) {
+                // peek into the node we didn't end up taking to determine the skip count
+                flagged_offset = node.flagged_target(edge);
+
+                tmp_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+                if (tmp_offset == 0 || static_cast<int>(data[tmp_offset]) == 0) {
+                    skip_count = 1;
+                } else {
+                    skip_count = compact_entry_count(format, data, tmp_offset);
+                }
+
+                if (skip_count < remaining) {
+                    remaining -= skip_count;
+                    continue;
+                }
+
+                match_string += node.letter(edge);
+                break;
+            }
+        }
+        if (edge == node.edge_count) {
+            return output;
+        }
+        flagged_offset = node.flagged_target(edge);
+
+        node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+        node_final = flagged_offset & IS_FINAL_FLAG;
+
+        if (node_final != 0u) {
+            remaining -= 1;
+        }
+
+        if (node_offset == 0) {
+            node_offset = -1;
+        }
+
+        if (remaining == 0 && (node_final != 0u)) {
+            break;
+        }
+    }
+
+    output.node_offset = node_offset;
+    output.found = true;
+    output.final = (node_final != 0u);
+    output.child_count = skip_count;
+    output.skipped = index;
+    output.match_string = std::make_unique<std::string>(match_string);
+    return output;
+}
+
+compact_index_decoder::compact_index_decoder(compact_format const& format, const unsigned char* data)
+    : format(format),
+      data(data) {
+    // the root is never final and holds every entry
+    path.push_back({0, false, 0, static_cast<unsigned int>(compact_entry_count(format, data, 0)), 0});
+}
+
+bool compact_index_decoder::decode(unsigned int index) {
+    // walk back up to the step holding the index; the root is never popped
+    while (path.size() > 1 && index - path.back().first >= path.back().count) {
+        path.pop_back();
+    }
+    if (index >= path.back().first + path.back().count) {
+        // past the last entry
+        return false;
+    }
+    current_word.resize(path.back().word_length);
+
+    while (true) {
+        step const& top = path.back();
+        if (top.final && index == top.first) {
+            return true;
+        }
+        if (top.node_offset == -1) {
+            return false;
+        }
+
+        compact_node node = read_compact_node(format, data, top.node_offset);
+        current_word.append(reinterpret_cast<const char*>(node.tail), node.tail_length);
+
+        // the entry's position among those below the node's edges
+        unsigned int below = index - top.first - (top.final ? 1 : 0);
+        unsigned int edge, skipped = 0, child_count = 0;
+        if (node.ranks != nullptr) {
+            edge = node.find_rank(below + 1);
+            if (edge < node.edge_count) {
+                skipped = node.rank_before(edge);
+                child_count = node.rank(edge) - skipped;
+            }
+        } else {
+            for (edge = 0; edge < node.edge_count; edge++) {
+                unsigned int target = node.flagged_target(edge) & FINAL_MASK;
+                child_count = (target == 0 || data[target] == 0) ? 1 : static_cast<unsigned int>(compact_entry_count(format, data, static_cast<int>(target)));
+                if (below < skipped + child_count) {
+                    break;
+                }
+                skipped += child_count;
+            }
+        }
+        if (edge == node.edge_count) {
+            return false;
+        }
+
+        current_word += static_cast<char>(node.letter(edge));
+        unsigned int flagged_offset = node.flagged_target(edge);
+        int child_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+        path.push_back({child_offset == 0 ? -1 : child_offset,
+                        (flagged_offset & IS_FINAL_FLAG) != 0u,
+                        top.first + (top.final ? 1 : 0) + skipped,
+                        child_count,
+                        current_word.size()});
+    }
+}
+
+void compact_iterator_start(compact_format const& format, const unsigned char* data, int node_offset, unsigned int tail_index, std::vector<node_position>* stack, std::vector<unsigned char>* current_word) {
+    // nothing to walk below leaves
+    if (node_offset == -1 || data[node_offset] == 0) return;
+
+    compact_node node = read_compact_node(format, data, node_offset);
+    current_word->assign(node.tail + tail_index, node.tail + node.tail_length);
+    stack->emplace_back(node_offset, 0, false);
+}
+
+bool compact_iterator_seek(compact_format const& format, const unsigned char* data, unsigned int index, std::vector<node_position>* stack, std::vector<unsigned char>* current_word) {
+    stack->clear();
+    current_word->clear();
+
+    int node_offset = 0;
+    // the entry's position among those below the current node, from 1
+    unsigned int remaining = index + 1;
+    while (node_offset > 0 || (node_offset == 0 && data[0] != 0)) {
+        compact_node node = read_compact_node(format, data, node_offset);
+        current_word->insert(current_word->end(), node.tail, node.tail + node.tail_length);
+
+        unsigned int edge, skipped = 0;
+        if (node.ranks != nullptr) {
+            edge = node.find_rank(remaining);
+            if (edge < node.edge_count) {
+                skipped = node.rank_before(edge);
+            }
+        } else {
+            for (edge = 0; edge < node.edge_count; edge++) {
+                unsigned int target = node.flagged_target(edge) & FINAL_MASK;
+                unsigned int child_count = (target == 0 || data[target] == 0) ? 1 : static_cast<unsigned int>(compact_entry_count(format, data, static_cast<int>(target)));
+                if (remaining <= skipped + child_count) {
+                    break;
+                }
+                skipped += child_count;
+            }
+        }
+        if (edge == node.edge_count) {
+            break;
+        }
+        remaining -= skipped;
+        stack->emplace_back(static_cast<unsigned int>(node_offset), edge, false);
+
+        unsigned int flagged_offset = node.flagged_target(edge);
+        if ((flagged_offset & IS_FINAL_FLAG) != 0u && --remaining == 0) {
+            // the walk yields the word ending along this edge next
+            return true;
+        }
+        current_word->push_back(node.letter(edge));
+        node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+        if (node_offset == 0) {
+            break;
+        }
+    }
+
+    stack->clear();
+    current_word->clear();
+    return false;
+}
+
+unsigned int compact_lower_bound(compact_format const& format, const unsigned char* data, const unsigned char* search, size_t search_length) {
+    unsigned int before = 0;
+    int node_offset = 0;
+    bool node_final = false;
+    size_t i = 0;
+
+    while (i < search_length) {
+        // the word ending at this node is a proper prefix of the search
+        if (node_final) {
+            before++;
+        }
+        if (node_offset == -1) {
+            return before;
+        }
+
+        compact_node node = read_compact_node(format, data, node_offset);
+        for (unsigned int t = 0; t < node.tail_length; t++, i++) {
+            if (i == search_length || search[i] < node.tail[t]) {
+                return before;
+            }
+            if (search[i] > node.tail[t]) {
+                // everything along and below the tail sorts first
+                return before + static_cast<unsigned int>(compact_entry_count(format, data, node_offset)) - (node_final ? 1 : 0);
+            }
+        }
+        if (i == search_length) {
+            return before;
+        }
+
+        unsigned int edge;
+        for (edge = 0; edge < node.edge_count && node.letter(edge) < search[i]; edge++) {
+            if (node.ranks == nullptr) {
+                unsigned int target = node.flagged_target(edge) & FINAL_MASK;
+                before += (target == 0 || data[target] == 0) ? 1 : static_cast<unsigned int>(compact_entry_count(format, data, static_cast<int>(target)));
+            }
+        }
+        if (node.ranks != nullptr) {
+            before += node.rank_before(edge);
+        }
+        if (edge == node.edge_count || node.letter(edge) != search[i]) {
+            return before;
+        }
+
+        unsigned int flagged_offset = node.flagged_target(edge);
+        node_final = (flagged_offset & IS_FINAL_FLAG) != 0u;
+        node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+        if (node_offset == 0) {
+            node_offset = -1;
+        }
+        i++;
+    }
+    return before;
+}
+
+bool compact_iterator_next(compact_format const& format, const unsigned char* data, std::vector<node_position>* stack, std::vector<unsigned char>* current_word, std::string* output) {
+    unsigned int flagged_offset, next_final = 0;
+    unsigned int next_offset = 0, edge_count = 0;
+    unsigned char letter;
+
+    bool has_output = false;
+
+    while (!stack->empty() && !has_output) {
+        node_position const& current_position = stack->back();
+        // NOTE: since `pop_back()` below will invalidate iterators
+        // we work with copies of the node_position data rather
+        // than the node_position reference itself (which may become invalid)
+        unsigned int cur_off = current_position.node_offset;
+        unsigned int cur_idx = current_position.edge_idx;
+        bool cur_visited = current_position.visited;
+
+        compact_node node = read_compact_node(format, data, static_cast<int>(cur_off));
+        letter = node.letter(cur_idx);
+
+        flagged_offset = node.flagged_target(cur_idx);
+        next_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+        next_final = flagged_offset & IS_FINAL_FLAG;
+
+        if ((next_final != 0u) && !cur_visited) {
+            has_output = true;
+            output->append(current_word->begin(), current_word->end());
+            output->push_back(static_cast<char>(letter));
+        }
+
+        if (next_offset == 0 || data[next_offset] == 0 || cur_visited) {
+            stack->pop_back();
+
+            if (!stack->empty()) {
+                node_position& latest_back = stack->back();
+                latest_back.visited = true;
+            }
+
+            edge_count = node.edge_count;
+            if (cur_idx < edge_count - 1) {
+                // done with the children, but still have siblings so move laterally
+                unsigned int next_position = cur_idx;
+                next_position++;
+                // add a copy to the stack
+                stack->emplace_back(cur_off, next_position, false);
+            } else {
+                // otherwise we'll move back up the tree, dropping the letter
+                // that led here and the node's tail
+                std::size_t drop = std::min(current_word->size(), static_cast<std::size_t>(1 + node.tail_length));
+                current_word->resize(current_word->size() - drop);
+            }
+        } else {
+            // "recurse" down
+            stack->emplace_back(next_offset, 0, false);
+            current_word->push_back(letter);
+            compact_node next = read_compact_node(format, data, static_cast<int>(next_offset));
+            current_word->insert(current_word->end(), next.tail, next.tail + next.tail_length);
+        }
+    }
+
+    return has_output;
+}
+
+void compact_prefixes_of(compact_format const& format, const unsigned char* data, const unsigned char* key, std::size_t key_length, std::vector<prefix_match>* matches) {
+    bool counted = has_entry_counts(format.node_size);
+    // how many words sort before the current node's
+    unsigned int before = 0;
+    int node_offset = 0;
+    std::size_t i = 0;
+
+    while (i < key_length && node_offset != -1) {
+        compact_node node = read_compact_node(format, data, node_offset);
+        if (!node.match_tail(key, key_length, &i) || i == key_length) {
+            return;
+        }
+        int edge = node.find(key[i]);
+        if (edge == -1) {
+            return;
+        }
+
+        if (counted) {
+            if (node.ranks != nullptr) {
+                before += node.rank_before(static_cast<unsigned int>(edge));
+            } else {
+                for (int sibling = 0; sibling < edge; sibling++) {
+                    unsigned int target = node.flagged_target(static_cast<unsigned int>(sibling)) & FINAL_MASK;
+                    before += (target == 0 || data[target] == 0) ? 1 : static_cast<unsigned int>(compact_entry_count(format, data, static_cast<int>(target)));
+                }
+            }
+        }
+
+        unsigned int flagged_offset = node.flagged_target(static_cast<unsigned int>(edge));
+        i++;
+        if ((flagged_offset & IS_FINAL_FLAG) != 0u) {
+            matches->push_back({i, counted ? static_cast<int>(before) : -1});
+            before++;
+        }
+        node_offset = static_cast<int>(flagged_offset & FINAL_MASK);
+        if (node_offset == 0) {
+            node_offset = -1;
+        }
+    }
+}
+
+compact_fuzzy_search::compact_fuzzy_search(compact_format const& format, const unsigned char* data, const unsigned char* key, std::size_t key_length, unsigned int max_edits, bool prefix, std::size_t limit)
+    : format(format),
+      data(data),
+      key(key),
+      key_length(key_length),
+      max_edits(max_edits),
+      prefix(prefix),
+      limit(limit),
+      counted(has_entry_counts(format.node_size)),
+      reach(static_cast<int>(max_edits)),
+      found_at(max_edits + 1, 0) {}
+
+std::vector<fuzzy_match> compact_fuzzy_search::run() {
+    // the row for the empty word
+    rows.resize(key_length + 1);
+    for (std::size_t j = 0; j <= key_length; j++) {
+        rows[j] = capped(static_cast<unsigned int>(j));
+    }
+    best.assign(1, rows[key_length]);
+
+    if (data[0] != 0) {
+        visit(0, counted ? static_cast<unsigned int>(compact_entry_count(format, data, 0)) : 0);
+    }
+
+    std::stable_sort(matches.begin(), matches.end(), [](fuzzy_match const& a, fuzzy_match const& b) {
+        return a.distance < b.distance;
+    });
+    if (limit > 0 && matches.size() > limit) {
+        matches.resize(limit);
+    }
+    return std::move(matches);
+}
+
+unsigned int compact_fuzzy_search::capped(unsigned int distance) const { return std::min(distance, max_edits + 1); }
+
+bool compact_fuzzy_search::push_letter(unsigned char letter) {
+    std::size_t depth = word.size() + 1;
+    std::size_t width = key_length + 1;
+    rows.resize((depth + 1) * width, max_edits + 1);
+    const unsigned int* previous = &rows[(depth - 1) * width];
+    unsigned int* row = &rows[depth * width];
+
+    std::size_t low = depth > max_edits ? depth - max_edits : 1;
+    std::size_t high = std::min(key_length, depth + max_edits);
+    row[0] = capped(static_cast<unsigned int>(std::min<std::size_t>(depth, max_edits + 1)));
+    unsigned int smallest = row[0];
+    for (std::size_t j = 1; j <= key_length; j++) {
+        if (j < low || j > high) {
+            row[j] = max_edits + 1;
+            continue;
+        }
+        unsigned int substitution = previous[j - 1] + (key[j - 1] == letter ? 0 : 1);
+        row[j] = capped(std::min({previous[j] + 1, row[j - 1] + 1, substitution}));
+        smallest = std::min(smallest, row[j]);
+    }
+
+    word.push_back(static_cast<char>(letter));
+    best.resize(depth + 1);
+    best[depth] = std::min(best[depth - 1], row[key_length]);
+    auto within = static_cast<unsigned int>(reach);
+    return reach >= 0 && (smallest <= within || (prefix && best[depth] <= within));
+}
+
+void compact_fuzzy_search::pop_letter() {
+    word.pop_back();
+}
+
+unsigned int compact_fuzzy_search::distance() const {
+    return prefix ? best[word.size()] : rows[(word.size() * (key_length + 1)) + key_length];
+}
+
+void compact_fuzzy_search::add_match(unsigned int d) {
+    matches.push_back({word, d, counted ? static_cast<int>(next_index) : -1});
+    if (limit == 0) {
+        return;
+    }
+    // once there are `limit` matches at or below some distance, later
+    // ones need to be closer than that to be kept
+    found_at[d]++;
+    std::size_t kept = 0;
+    for (int i = 0; i <= reach; i++) {
+        kept += found_at[i];
+        if (kept >= limit) {
+            reach = i - 1;
+            break;
+        }
+    }
+}
+
+void compact_fuzzy_search::visit(int node_offset, unsigned int below) {
+    compact_node node = read_compact_node(format, data, node_offset);
+    std::size_t base = word.size();
+
+    for (unsigned int t = 0; t < node.tail_length; t++) {
+        if (!push_letter(node.tail[t])) {
+            next_index += below;
+            word.resize(base);
+            return;
+        }
+    }
+
+    for (unsigned int edge = 0; edge < node.edge_count && reach >= 0; edge++) {
+        unsigned int flagged_offset = node.flagged_target(edge);
+        unsigned int target = flagged_offset & FINAL_MASK;
+        bool final = (flagged_offset & IS_FINAL_FLAG) != 0u;
+        bool has_children = target != 0 && data[target] != 0;
+        unsigned int child_count = 0;
+        if (counted) {
+            child_count = has_children ? static_cast<unsigned int>(compact_entry_count(format, data, static_cast<int>(target))) : 1;
+        }
+
+        if (push_letter(node.letter(edge))) {
+            if (final) {
+                unsigned int d = distance();
+                if (static_cast<int>(d) <= reach) {
+                    add_match(d);
+                }
+                next_index++;
+            }
+            if (has_children) {
+                visit(static_cast<int>(target), child_count - (final ? 1 : 0));
+            }
+        } else {
+            next_index += child_count;
+        }
+        pop_letter();
+    }
+    word.resize(base);
+}
+
+bool score_table::read(const unsigned char* buf, std::size_t length) {
+    if (length < SCORE_TABLE_HEADER_SIZE || memcmp(buf, SCORE_TABLE_MAGIC, 4) != 0) {
+        return false;
+    }
+    memcpy(&count, buf + 4, sizeof(unsigned int));
+    memcpy(&leaves, buf + 8, sizeof(unsigned int));
+    std::size_t expected = SCORE_TABLE_HEADER_SIZE + (sizeof(unsigned int) * (count + (2 * static_cast<std::size_t>(leaves))));
+    if (length != expected) {
+        return false;
+    }
+    scores = buf + SCORE_TABLE_HEADER_SIZE;
+    tree = scores + (sizeof(unsigned int) * count);
+    return true;
+}
+
+unsigned int score_table::score(unsigned int index) const {
+    unsigned int value;
+    memcpy(&value, scores + (index * sizeof(unsigned int)), sizeof(unsigned int));
+    return value;
+}
+
+unsigned int score_table::tree_at(unsigned int i) const {
+    unsigned int value;
+    memcpy(&value, tree + (i * sizeof(unsigned int)), sizeof(unsigned int));
+    return value;
+}
+
+unsigned int score_table::range_max(unsigned int first, unsigned int length) const {
+    unsigned int best = 0;
+    unsigned int end = first + length;
+    unsigned int first_block = first / SCORE_BLOCK_SIZE, last_block = (end - 1) / SCORE_BLOCK_SIZE;
+    if (first_block == last_block) {
+        for (unsigned int i = first; i < end; i++) {
+            best = std::max(best, score(i));
+        }
+        return best;
+    }
+
+    // the partial blocks at either end, then the whole ones between
+    for (unsigned int i = first; i < (first_block + 1) * SCORE_BLOCK_SIZE; i++) {
+        best = std::max(best, score(i));
+    }
+    for (unsigned int i = last_block * SCORE_BLOCK_SIZE; i < end; i++) {
+        best = std::max(best, score(i));
+    }
+    for (unsigned int low = leaves + first_block + 1, high = leaves + last_block; low < high; low >>= 1, high >>= 1) {
+        if ((low & 1) != 0) {
+            best = std::max(best, tree_at(low++));
+        }
+        if ((high & 1) != 0) {
+            best = std::max(best, tree_at(--high));
+        }
+    }
+    return best;
+}
+
+std::vector<completion> compact_top_completions(compact_format const& format, const unsigned char* data, score_table const& scores, const unsigned char* prefix, std::size_t prefix_length, std::size_t limit) {
+    struct candidate {
+        unsigned int score;
+        unsigned int first;
+        // a word, or the words below a node if count is non-zero
+        unsigned int count;
+        int node_offset;
+        unsigned int tail_index;
+        bool final;
+        std::string word;
+    };
+    // the heap's top is the best score, then the lowest index, then words
+    // ahead of the nodes they begin
+    auto worse = [](candidate const& a, candidate const& b) {
+        if (a.score != b.score) return a.score < b.score;
+        if (a.first != b.first) return a.first > b.first;
+        return a.count > b.count;
+    };
+
+    std::vector<completion> results;
+    std::vector<candidate> heap;
+    if (limit == 0) {
+        return results;
+    }
+
+    // find the node the prefix leads to and the range of words below it
+    unsigned int first = 0, count = 0;
+    dawg_search_result found;
+    if (prefix_length == 0) {
+        count = static_cast<unsigned int>(compact_entry_count(format, data, 0));
+        found.node_offset = 0;
+    } else {
+        dawg_search_result counted = counted_compact_dawg_search(format, data, prefix, prefix_length);
+        if (!counted.found) {
+            return results;
+        }
+        first = static_cast<unsigned int>(counted.skipped);
+        count = static_cast<unsigned int>(counted.child_count);
+        found = compact_dawg_search(format, data, prefix, prefix_length);
+    }
+    if (count == 0) {
+        return results;
+    }
+    heap.push_back({scores.range_max(first, count), first, count, found.node_offset, found.tail_index, found.final, std::string(reinterpret_cast<const char*>(prefix), prefix_length)});
+
+    while (!heap.empty() && results.size() < limit) {
+        std::pop_heap(heap.begin(), heap.end(), worse);
+        candidate best = std::move(heap.back());
+        heap.pop_back();
+
+        if (best.count == 0) {
+            results.push_back({std::move(best.word), best.first, best.score});
+            continue;
+        }
+
+        unsigned int next = best.first;
+        if (best.final) {
+            heap.push_back({scores.score(next), next, 0, -1, 0, true, best.word});
+            std::push_heap(heap.begin(), heap.end(), worse);
+            next++;
+        }
+        if (best.node_offset == -1 || data[best.node_offset] == 0) {
+            continue;
+        }
+
+        compact_node node = read_compact_node(format, data, best.node_offset);
+        best.word.append(reinterpret_cast<const char*>(node.tail) + best.tail_index, node.tail_length - best.tail_index);
+        for (unsigned int edge = 0; edge < node.edge_count; edge++) {
+            unsigned int flagged_offset = node.flagged_target(edge);
+            unsigned int target = flagged_offset & FINAL_MASK;
+            bool has_children = target != 0 && data[target] != 0;
+            unsigned int child_count;
+            if (node.ranks != nullptr) {
+                child_count = node.rank(edge) - node.rank_before(edge);
+            } else {
+                child_count = has_children ? static_cast<unsigned int>(compact_entry_count(format, data, static_cast<int>(target))) : 1;
+            }
+
+            std::string word = best.word;
+            word.push_back(static_cast<char>(node.letter(edge)));
+            if (has_children) {
+                heap.push_back({scores.range_max(next, child_count), next, child_count, static_cast<int>(target), 0, (flagged_offset & IS_FINAL_FLAG) != 0u, std::move(word)});
+            } else {
+                heap.push_back({scores.score(next), next, 0, -1, 0, true, std::move(word)});
+            }
+            std::push_heap(heap.begin(), heap.end(), worse);
+            next += child_count;
+        }
+    }
+    return results;
+}
+
+} // namespace detail
+} // namespace dawgcache
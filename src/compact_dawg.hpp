@@ -0,0 +1,309 @@
+#ifndef DAWG_COMPACT_DAWG_HEADER
+#define DAWG_COMPACT_DAWG_HEADER 1
+
+// The compact dawg format (written by builder.cpp) and the search, iteration
+// and other read-only algorithms over it, in compact_dawg.cpp. Nothing here
+// depends on node: this is shared by the node binding and the dawgcache
+// library (dawgcache.hpp), and it only ever reads the dawg, so any number of
+// threads can search the same one at once.
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dawgcache {
+namespace detail {
+
+const unsigned int IS_FINAL_FLAG = 0x80000000;
+const unsigned int NOT_FINAL_FLAG = 0;
+const unsigned int FINAL_MASK = 0x7fffffff;
+
+const unsigned int DAWG_HEADER_SIZE = 16;
+
+const unsigned int EDGE_COUNT_ONLY = 1;
+const unsigned int INCLUDES_ENTRY_COUNT = 5;
+// INCLUDES_ENTRY_COUNT, plus a table after each node's edges holding the
+// running total of entries below its edges, so counted lookups can binary
+// search it instead of visiting every sibling
+const unsigned int INCLUDES_EDGE_RANKS = 9;
+
+inline bool has_entry_counts(unsigned int node_size) {
+    return node_size != EDGE_COUNT_ONLY;
+}
+
+// the size of the fixed node header in versions 1 and 2
+inline unsigned int node_header_size(unsigned int node_size) {
+    return has_entry_counts(node_size) ? INCLUDES_ENTRY_COUNT : EDGE_COUNT_ONLY;
+}
+
+// each edge is its letter followed by its 4-byte flagged offset
+const unsigned int DAWG_VERSION_INTERLEAVED_EDGES = 1;
+// all of a node's letters, followed by all of its flagged offsets
+const unsigned int DAWG_VERSION_SPLIT_EDGES = 2;
+// split edges, but the edge and entry counts are varints and the offsets are
+// as narrow as the size of the dawg allows, with the final flag in the top
+// bit of each
+const unsigned int DAWG_VERSION_VARIABLE_WIDTH = 3;
+// like version 3, but chains of single-child, non-final nodes are folded
+// into their first node as a "tail" string of letters
+const unsigned int DAWG_VERSION_TAILS = 4;
+
+inline bool supported_dawg_version(unsigned int version) {
+    return version >= DAWG_VERSION_INTERLEAVED_EDGES && version <= DAWG_VERSION_TAILS;
+}
+
+/* header format 16 bytes, consisting of:
+    * the string "dawg" (4 bytes)
+    * version number (1 byte) - 1 to 4, see DAWG_VERSION_*
+    * size in bytes of each character (1 byte) - currently always 1
+    * size in bytes of each node structure (1 byte):
+    *   either 1 byte if it's just an edge count
+    *   or 5 if it's an edge count (1 byte) and an entry count (4 bytes)
+    *   or 9 if it's that, followed after the edges by a 4-byte running
+    *   total of entries for each edge
+    *   (from version 3 the counts are varints, so this only says whether
+    *   the entry count is there)
+    * size in bytes of each node offset (1 byte) - 4, or 2 to 4 from version 3
+    * size in bytes of the datastructure (does not include this header)
+    * the crc32c checksum of the datastructure (does not include this header)
+*/
+
+// A score table holds a u32 score for each entry of a counted dawg, by
+// index, followed by a max tree over blocks of SCORE_BLOCK_SIZE of them:
+// `leaves` (a power of two at least the number of blocks) u32 slots, then
+// tree[i] = max(tree[2i], tree[2i + 1]), with block maxima at
+// tree[leaves + block]. The header is the magic "dsco", then the entry count
+// and leaf count as u32s, then four unused bytes.
+const unsigned int SCORE_TABLE_HEADER_SIZE = 16;
+const unsigned int SCORE_BLOCK_SIZE = 64;
+constexpr char SCORE_TABLE_MAGIC[] = "dsco";
+
+struct node_position {
+    unsigned int node_offset;
+    unsigned int edge_idx;
+    bool visited;
+    node_position(unsigned int off, unsigned int idx, bool v) : node_offset(off),
+                                                                edge_idx(idx),
+                                                                visited(v) {}
+    // non-copyable
+    node_position(node_position&&) noexcept = default;
+    node_position& operator=(node_position&&) noexcept = default; // NOLINT
+    ~node_position() noexcept = default;
+    node_position(node_position const&) = delete;
+    node_position& operator=(node_position const&) = delete;
+};
+
+struct dawg_search_result {
+    std::unique_ptr<std::string> match_string = nullptr;
+    int node_offset = -1;
+    // how many letters of node_offset's tail the search has already consumed
+    unsigned int tail_index = 0;
+    bool found = false;
+    bool final = false;
+    int skipped = -1;
+    int child_count = -1;
+};
+
+// Layout details of a compact dawg, as read from its header.
+struct compact_format {
+    unsigned int version;
+    unsigned int node_size;
+    unsigned int offset_width;
+};
+
+inline compact_format read_compact_format(const unsigned char* header) {
+    return {static_cast<unsigned int>(header[4]), static_cast<unsigned int>(header[6]), static_cast<unsigned int>(header[7])};
+}
+
+// the number of entries reachable from a node, in dawgs with entry counts
+int compact_entry_count(compact_format const& format, const unsigned char* data, int node_offset);
+
+dawg_search_result compact_dawg_search(compact_format const& format, const unsigned char* data, const unsigned char* search, size_t search_length);
+
+// a key in a batch lookup, as a byte range of a shared buffer
+struct search_key {
+    std::size_t offset;
+    std::size_t length;
+};
+
+// Searches many keys with the same semantics as compact_dawg_search, writing
+// 0 (not found), 1 (found as a prefix) or 2 (found as a word) to results[i]
+// for each keys[i]. Instead of walking one key to the end before starting the
+// next, it keeps SEARCH_LANES keys in flight and advances each by one letter
+// per round, prefetching the node every lane visits next. On dawgs much larger
+// than the cache the misses of different keys then overlap rather than
+// stalling one after the other.
+void compact_dawg_search_many(compact_format const& format, const unsigned char* data, const unsigned char* base, const search_key* keys, std::size_t num_keys, unsigned char* results);
+
+// the most compact dawgs a CompactDawgSet can hold, one bit of a mask each
+constexpr std::size_t MAX_DAWG_SET_SIZE = 32;
+
+// a compact dawg in a CompactDawgSet
+struct dawg_set_member {
+    compact_format format;
+    const unsigned char* data;
+};
+
+// Looks a key up in each of a set of compact dawgs, returning a mask with
+// bit i set if the i-th has it as a word (or, with `prefix`, as a prefix).
+// As in compact_dawg_search_many, the dawgs are walked together, one letter
+// a round, so that the misses in different dawgs overlap; dawgs drop out as
+// soon as they can't match.
+unsigned int compact_dawg_set_search(dawg_set_member const* members, std::size_t num_members, const unsigned char* key, std::size_t key_length, bool prefix);
+
+dawg_search_result counted_compact_dawg_search(compact_format const& format, const unsigned char* data, const unsigned char* search, size_t search_length);
+
+dawg_search_result inverse_compact_dawg_search(compact_format const& format, const unsigned char* data, int index);
+
+// Turns many indexes back into words, keeping the path walked for the last
+// one so that the next only has to walk down from where the two diverge.
+// Indexes in sorted order share the most, but any order works.
+class compact_index_decoder {
+  public:
+    compact_index_decoder(compact_format const& format, const unsigned char* data);
+
+    // Leaves the word at `index` in word(), returning false if there's no
+    // such entry.
+    bool decode(unsigned int index);
+
+    std::string const& word() const { return current_word; }
+
+  private:
+    // a node on the current path, and the range of entries below it
+    struct step {
+        int node_offset;
+        bool final;
+        unsigned int first;
+        unsigned int count;
+        // the length of the word leading to the node, before its tail
+        std::size_t word_length;
+    };
+
+    compact_format const& format;
+    const unsigned char* data;
+    std::vector<step> path;
+    std::string current_word;
+};
+
+// Starts a depth-first walk over the words below a node, the given number
+// of letters into its tail.
+void compact_iterator_start(compact_format const& format, const unsigned char* data, int node_offset, unsigned int tail_index, std::vector<node_position>* stack, std::vector<unsigned char>* current_word);
+
+// Sets up a depth-first walk over the whole dawg so that the next word it
+// yields is the one at `index`, by walking down to it as
+// inverse_compact_dawg_search does. Returns false, leaving the walk empty,
+// if there's no such word. Requires embedded counts.
+bool compact_iterator_seek(compact_format const& format, const unsigned char* data, unsigned int index, std::vector<node_position>* stack, std::vector<unsigned char>* current_word);
+
+// Returns the number of words that sort before `search`, which is also the
+// index of the first word at or after it. Requires embedded counts.
+unsigned int compact_lower_bound(compact_format const& format, const unsigned char* data, const unsigned char* search, size_t search_length);
+
+// Advances a depth-first walk over a compact dawg to its next word, which is
+// appended to output (without the prefix the walk started from, if any).
+// Returns false once there are no more words.
+bool compact_iterator_next(compact_format const& format, const unsigned char* data, std::vector<node_position>* stack, std::vector<unsigned char>* current_word, std::string* output);
+
+// A prefix of a key that is a word: its length in bytes, and its index if
+// the dawg has counts (or -1).
+struct prefix_match {
+    std::size_t length;
+    int index;
+};
+
+// Finds every prefix of a key that is a word, shortest first, in a single
+// walk down the key's path.
+void compact_prefixes_of(compact_format const& format, const unsigned char* data, const unsigned char* key, std::size_t key_length, std::vector<prefix_match>* matches);
+
+// A word within the edit distance of a fuzzy search, and its index if the
+// dawg has counts (or -1).
+struct fuzzy_match {
+    std::string word;
+    unsigned int distance;
+    int index;
+};
+
+// Finds the words within a Levenshtein distance of a key in one walk over a
+// compact dawg, keeping a row of the edit distance table per letter of the
+// current path and pruning the subtrees where every entry of the row is out
+// of reach. Only the diagonal band of each row that can still be in reach is
+// computed. In prefix mode a word matches if any prefix of it does. With a
+// limit, the closest words are kept, ties going to the first in order, and
+// the reach shrinks as the search fills up. Distances are counted in bytes.
+class compact_fuzzy_search {
+  public:
+    compact_fuzzy_search(compact_format const& format, const unsigned char* data, const unsigned char* key, std::size_t key_length, unsigned int max_edits, bool prefix, std::size_t limit);
+
+    std::vector<fuzzy_match> run();
+
+  private:
+    compact_format const& format;
+    const unsigned char* data;
+    const unsigned char* key;
+    std::size_t key_length;
+    unsigned int max_edits;
+    bool prefix;
+    std::size_t limit;
+    bool counted;
+    // the largest distance a new match could still be kept at, or -1 once
+    // nothing can be
+    int reach;
+    // how many matches have been kept at each distance
+    std::vector<std::size_t> found_at;
+    // the edit distance rows for each prefix of word, one after another
+    std::vector<unsigned int> rows;
+    // in prefix mode, the smallest distance from the key to any prefix of
+    // the word so far, for each length of the word
+    std::vector<unsigned int> best;
+    std::string word;
+    // the index the next word in order would have
+    unsigned int next_index = 0;
+    std::vector<fuzzy_match> matches;
+
+    unsigned int capped(unsigned int distance) const;
+    // Extends the word by a letter, filling in its row. Returns whether
+    // anything starting with the new word can still be kept.
+    bool push_letter(unsigned char letter);
+    void pop_letter();
+    unsigned int distance() const;
+    void add_match(unsigned int d);
+    // Searches below a node, whose `below` entries (not counting the node
+    // itself) come next in order.
+    void visit(int node_offset, unsigned int below);
+};
+
+// A view of a score table (see SCORE_TABLE_HEADER_SIZE).
+struct score_table {
+    const unsigned char* scores = nullptr;
+    const unsigned char* tree = nullptr;
+    unsigned int count = 0;
+    unsigned int leaves = 0;
+
+    // Reads a table's header, returning false if it isn't one.
+    bool read(const unsigned char* buf, std::size_t length);
+
+    unsigned int score(unsigned int index) const;
+    unsigned int tree_at(unsigned int i) const;
+
+    // the best score of the `length` entries from `first`
+    unsigned int range_max(unsigned int first, unsigned int length) const;
+};
+
+struct completion {
+    std::string word;
+    unsigned int index;
+    unsigned int score;
+};
+
+// Returns the `limit` best-scoring words starting with a prefix, best first
+// and then in order, from a counted dawg. Searches best-first: candidates
+// are either words or the words below a node, the latter ranked by the best
+// score in their range of indexes, so only the nodes on the way to the
+// results (and their siblings) are ever read.
+std::vector<completion> compact_top_completions(compact_format const& format, const unsigned char* data, score_table const& scores, const unsigned char* prefix, std::size_t prefix_length, std::size_t limit);
+
+} // namespace detail
+} // namespace dawgcache
+
+#endif
@@ -3,6 +3,14 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DAWG_CRC32C_HARDWARE 1
+#include <nmmintrin.h>
+#endif
+
+namespace dawgcache {
+namespace detail {
 
 static const uint32_t crc32cLookup[256] = {
     0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C, 0x26A1E7E8, 0xD4CA64EB,
@@ -39,14 +47,92 @@ static const uint32_t crc32cLookup[256] = {
     0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351,
 };
 
-inline uint32_t crc32c(unsigned char* data, size_t length, uint32_t previousCrc32 = 0) {
-    uint32_t crc = ~previousCrc32;
-    unsigned char* current = data;
+// Tables for slicing-by-8: crc32cTables().table[k][b] is the crc of byte b
+// followed by k zero bytes, which lets the software path fold eight input
+// bytes per step.
+struct crc32c_slicing_tables {
+    uint32_t table[8][256];
+    crc32c_slicing_tables() : table() {
+        for (int i = 0; i < 256; i++) {
+            table[0][i] = crc32cLookup[i];
+        }
+        for (int k = 1; k < 8; k++) {
+            for (int i = 0; i < 256; i++) {
+                uint32_t prev = table[k - 1][i];
+                table[k][i] = (prev >> 8) ^ crc32cLookup[prev & 0xFF];
+            }
+        }
+    }
+};
+
+inline const crc32c_slicing_tables& crc32cTables() {
+    static const crc32c_slicing_tables tables;
+    return tables;
+}
+
+inline uint32_t crc32c_slicing(const unsigned char* data, size_t length, uint32_t crc) {
+    const uint32_t(&t)[8][256] = crc32cTables().table;
+    const unsigned char* current = data;
+    while (length >= 8) {
+        uint32_t one = (static_cast<uint32_t>(current[0]) |
+                        static_cast<uint32_t>(current[1]) << 8 |
+                        static_cast<uint32_t>(current[2]) << 16 |
+                        static_cast<uint32_t>(current[3]) << 24) ^
+                       crc;
+        uint32_t two = static_cast<uint32_t>(current[4]) |
+                       static_cast<uint32_t>(current[5]) << 8 |
+                       static_cast<uint32_t>(current[6]) << 16 |
+                       static_cast<uint32_t>(current[7]) << 24;
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        current += 8;
+        length -= 8;
+    }
     while (length > 0) {
-        crc = (crc >> 8) ^ crc32cLookup[(crc & 0xFF) ^ *current++];
+        crc = (crc >> 8) ^ t[0][(crc & 0xFF) ^ *current++];
         --length;
     }
-    return ~crc;
+    return crc;
 }
 
-#endif
\ No newline at end of file
+#ifdef DAWG_CRC32C_HARDWARE
+// SSE4.2 has a dedicated instruction for exactly this polynomial; it is
+// compiled for that target only, and called after checking the CPU at runtime.
+__attribute__((target("sse4.2"))) inline uint32_t crc32c_hardware(const unsigned char* data, size_t length, uint32_t crc) {
+    const unsigned char* current = data;
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, current, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        current += 8;
+        length -= 8;
+    }
+    auto crc32 = static_cast<uint32_t>(crc64);
+    while (length > 0) {
+        crc32 = _mm_crc32_u8(crc32, *current++);
+        --length;
+    }
+    return crc32;
+}
+
+inline bool crc32c_has_hardware() {
+    static const bool supported = __builtin_cpu_supports("sse4.2") != 0;
+    return supported;
+}
+#endif
+
+inline uint32_t crc32c(const unsigned char* data, size_t length, uint32_t previousCrc32 = 0) {
+    uint32_t crc = ~previousCrc32;
+#ifdef DAWG_CRC32C_HARDWARE
+    if (crc32c_has_hardware()) {
+        return ~crc32c_hardware(data, length, crc);
+    }
+#endif
+    return ~crc32c_slicing(data, length, crc);
+}
+
+} // namespace detail
+} // namespace dawgcache
+
+#endif
@@ -1,102 +1,216 @@
 // based on python code by Steve Hanov, 2011
 
 #include <algorithm>
-#include <map>
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+struct DawgEdge {
+    unsigned char letter;
+    unsigned int child;
+};
+
+// Nodes live in Dawg::nodes and are addressed by their index there. Once a
+// node has been minimized its edges are frozen and stored contiguously (and
+// sorted by letter) in Dawg::edges; until then they're kept in a per-depth
+// scratch list, since unchecked nodes are the only ones that still grow.
 class DawgNode {
   public:
-    unsigned int id;
     bool final;
-    std::map<unsigned char, std::shared_ptr<DawgNode>> edges;
+    // true while the node's edges live in Dawg::pending_edges
+    bool pending;
+    unsigned short edge_count;
+    // index of the first edge in Dawg::edges, or the depth of the node
+    // in the unchecked chain while it is pending
+    unsigned int first_edge;
     // Number of end nodes reachable from this one.
     unsigned int count;
     DawgNode();
-    unsigned int num_reachable();
-
-    std::string to_string() {
-        std::string out = "";
-        if (final) {
-            out += "1_";
-        } else {
-            out += "0_";
-        }
-
-        for (auto const& edge : edges) {
-            out.push_back(edge.first);
-            out.push_back('_');
-            out += std::to_string(edge.second->id);
-            out.push_back('_');
-        }
-
-        // remove final _
-        out.pop_back();
-        return out;
-    }
 };
 
-DawgNode::DawgNode() : id(0),
-                       final(false),
+DawgNode::DawgNode() : final(false),
+                       pending(false),
+                       edge_count(0),
+                       first_edge(0),
                        count(0) {}
 
-unsigned int DawgNode::num_reachable() {
-    // if a count is already assigned, return it
-    if (count) return count;
-
-    // count the number of final nodes that are reachable from this one.
-    // including self
-    int counter = 0;
-    if (final) counter += 1;
-    for (auto const& edge : edges) {
-        counter += edge.second->num_reachable();
-    }
-
-    count = counter;
-    return counter;
-}
-
-class DawgNodeCheckEntry {
-  public:
-    DawgNodeCheckEntry(char let,
-                       std::shared_ptr<DawgNode> const& par)
-        : parent(par),
-          child(std::make_shared<DawgNode>()),
-          letter(let) {}
-    // make this class noncopyable, only movable
-    DawgNodeCheckEntry(DawgNodeCheckEntry&&) = default;
-    DawgNodeCheckEntry(DawgNodeCheckEntry const&) = delete;
-    DawgNodeCheckEntry& operator=(DawgNodeCheckEntry const&) = delete;
-
-    std::shared_ptr<DawgNode> parent;
-    std::shared_ptr<DawgNode> child;
-    char letter;
+struct DawgEdgeRange {
+    DawgEdge* first;
+    DawgEdge* last;
+    DawgEdge* begin() const { return first; }
+    DawgEdge* end() const { return last; }
+    std::size_t size() const { return static_cast<std::size_t>(last - first); }
 };
 
 class Dawg {
   public:
     std::string previous_word;
-    std::shared_ptr<DawgNode> root;
-    std::vector<DawgNodeCheckEntry> unchecked_nodes;
-    std::unordered_map<std::string, std::shared_ptr<DawgNode>> minimized_nodes;
-    int node_counter;
+    unsigned int root;
+    std::vector<DawgNode> nodes;
+    std::vector<DawgEdge> edges;
+    std::vector<std::vector<DawgEdge>> pending_edges;
+    std::vector<unsigned int> free_nodes;
+    // unchecked_nodes[i] is the most recently inserted node at depth i + 1
+    std::vector<unsigned int> unchecked_nodes;
+    // open-addressed register of minimized nodes, keyed by their structure
+    // (final flag plus letter/child pairs); 0 marks an empty slot, which is
+    // safe because the root is never registered
+    std::vector<unsigned int> minimized_nodes;
+    unsigned int minimized_count;
     Dawg();
     bool insert(const char* data, std::size_t len);
     void finish();
     bool lookup(const char* data, std::size_t len);
     bool lookup_prefix(const char* data, std::size_t len);
+    std::vector<std::size_t> prefixes_of(const char* data, std::size_t len);
+    void merge(std::vector<std::unique_ptr<Dawg>>* shards);
     unsigned int edge_count();
     unsigned int node_count();
+    DawgEdgeRange edges_of(unsigned int node);
 
   private:
     void _minimize(int down_to);
+    unsigned int _new_node(unsigned int depth);
+    void _commit_node(unsigned int node);
+    void _release_node(unsigned int node);
+    std::size_t _node_hash(unsigned int node);
+    bool _equivalent(unsigned int a, unsigned int b);
+    std::size_t _find_slot(unsigned int node, std::size_t hash);
+    void _grow_register();
+    unsigned int _num_reachable(unsigned int node);
+    int _find_edge(unsigned int node, unsigned char letter);
+    std::vector<unsigned int> _import(Dawg& shard);
 };
 
 Dawg::Dawg() : previous_word(),
-               root(std::make_shared<DawgNode>()),
-               node_counter(1) {}
+               root(0),
+               minimized_nodes(1024, 0),
+               minimized_count(0) {
+    root = _new_node(0);
+}
+
+DawgEdgeRange Dawg::edges_of(unsigned int node) {
+    DawgNode const& n = nodes[node];
+    if (n.pending) {
+        std::vector<DawgEdge>& scratch = pending_edges[n.first_edge];
+        return {scratch.data(), scratch.data() + scratch.size()};
+    }
+    DawgEdge* first = edges.data() + n.first_edge;
+    return {first, first + n.edge_count};
+}
+
+unsigned int Dawg::_new_node(unsigned int depth) {
+    unsigned int node;
+    if (free_nodes.empty()) {
+        node = static_cast<unsigned int>(nodes.size());
+        nodes.emplace_back();
+    } else {
+        // recycle a node that turned out to be redundant
+        node = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[node] = DawgNode();
+    }
+
+    if (pending_edges.size() <= depth) {
+        pending_edges.resize(depth + 1);
+    }
+    nodes[node].pending = true;
+    nodes[node].first_edge = depth;
+    return node;
+}
+
+void Dawg::_commit_node(unsigned int node) {
+    std::vector<DawgEdge>& scratch = pending_edges[nodes[node].first_edge];
+    nodes[node].first_edge = static_cast<unsigned int>(edges.size());
+    nodes[node].edge_count = static_cast<unsigned short>(scratch.size());
+    nodes[node].pending = false;
+    edges.insert(edges.end(), scratch.begin(), scratch.end());
+    scratch.clear();
+}
+
+void Dawg::_release_node(unsigned int node) {
+    pending_edges[nodes[node].first_edge].clear();
+    free_nodes.push_back(node);
+}
+
+std::size_t Dawg::_node_hash(unsigned int node) {
+    std::uint64_t hash = nodes[node].final ? 1 : 0;
+    for (auto const& edge : edges_of(node)) {
+        hash ^= (static_cast<std::uint64_t>(edge.letter) << 32) | edge.child;
+        hash *= 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    return static_cast<std::size_t>(hash);
+}
+
+bool Dawg::_equivalent(unsigned int a, unsigned int b) {
+    if (nodes[a].final != nodes[b].final) return false;
+
+    DawgEdgeRange a_edges = edges_of(a);
+    DawgEdgeRange b_edges = edges_of(b);
+    if (a_edges.size() != b_edges.size()) return false;
+
+    for (std::size_t i = 0; i < a_edges.size(); i++) {
+        if (a_edges.first[i].letter != b_edges.first[i].letter || a_edges.first[i].child != b_edges.first[i].child) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns the slot holding a node equivalent to `node`, or the empty slot
+// where it should be registered
+std::size_t Dawg::_find_slot(unsigned int node, std::size_t hash) {
+    std::size_t mask = minimized_nodes.size() - 1;
+    std::size_t slot = hash & mask;
+    while (minimized_nodes[slot] != 0 && !_equivalent(minimized_nodes[slot], node)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void Dawg::_grow_register() {
+    std::vector<unsigned int> old_nodes(minimized_nodes.size() * 2, 0);
+    old_nodes.swap(minimized_nodes);
+
+    std::size_t mask = minimized_nodes.size() - 1;
+    for (unsigned int node : old_nodes) {
+        if (node == 0) continue;
+        std::size_t slot = _node_hash(node) & mask;
+        while (minimized_nodes[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        minimized_nodes[slot] = node;
+    }
+}
+
+unsigned int Dawg::_num_reachable(unsigned int node) {
+    // if a count is already assigned, return it
+    if (nodes[node].count) return nodes[node].count;
+
+    // count the number of final nodes that are reachable from this one.
+    // including self
+    unsigned int counter = 0;
+    if (nodes[node].final) counter += 1;
+    for (auto const& edge : edges_of(node)) {
+        counter += _num_reachable(edge.child);
+    }
+
+    nodes[node].count = counter;
+    return counter;
+}
+
+int Dawg::_find_edge(unsigned int node, unsigned char letter) {
+    DawgEdgeRange range = edges_of(node);
+    DawgEdge* edge = std::lower_bound(range.begin(), range.end(), letter, [](DawgEdge const& e, unsigned char l) {
+        return e.letter < l;
+    });
+    if (edge == range.end() || edge->letter != letter) {
+        return -1;
+    }
+    return static_cast<int>(edge->child);
+}
 
 bool Dawg::insert(const char* data, std::size_t len) {
     std::string word(data, len);
@@ -123,23 +237,24 @@ bool Dawg::insert(const char* data, std::size_t len) {
 
     // add the suffix, starting from the correct node mid-way through the
     // graph
-    std::shared_ptr<DawgNode> node;
+    unsigned int node;
     if (unchecked_nodes.empty()) {
         node = root;
     } else {
-        node = unchecked_nodes.back().child;
+        node = unchecked_nodes.back();
     }
 
     for (size_t i = common_prefix; i < len; i++) {
-        char letter = word[i];
-        unchecked_nodes.emplace_back(letter, node);
-        DawgNodeCheckEntry& check_entry = unchecked_nodes.back();
-        check_entry.child->id = node_counter++;
-        node->edges[letter] = check_entry.child;
-        node = check_entry.child;
+        auto letter = static_cast<unsigned char>(word[i]);
+        auto depth = static_cast<unsigned int>(unchecked_nodes.size());
+        unsigned int child = _new_node(depth + 1);
+        // words arrive in order, so new edges always sort after existing ones
+        pending_edges[depth].push_back({letter, child});
+        unchecked_nodes.push_back(child);
+        node = child;
     }
 
-    node->final = true;
+    nodes[node].final = true;
     previous_word = std::move(word);
 
     return true;
@@ -150,7 +265,7 @@ void Dawg::finish() {
     _minimize(0);
 
     // go through entire structure and assign the counts to each node.
-    root->num_reachable();
+    _num_reachable(root);
 }
 
 void Dawg::_minimize(int down_to) {
@@ -158,60 +273,154 @@ void Dawg::_minimize(int down_to) {
 
     int num_unchecked = static_cast<int>(unchecked_nodes.size());
     for (int i = num_unchecked - 1; i >= down_to; i--) {
-        DawgNodeCheckEntry& to_check = unchecked_nodes[i];
-        std::string child_string = to_check.child->to_string();
-        if (minimized_nodes.count(child_string) > 0) {
-            // replace the child with the previously encountered one
-            to_check.parent->edges[to_check.letter] = minimized_nodes[child_string];
+        unsigned int child = unchecked_nodes[i];
+        std::size_t slot = _find_slot(child, _node_hash(child));
+        if (minimized_nodes[slot] != 0) {
+            // replace the child with the previously encountered one; the
+            // child is always the last edge of its (still pending) parent
+            pending_edges[i].back().child = minimized_nodes[slot];
+            _release_node(child);
         } else {
             // add the state to the minimized nodes.
-            minimized_nodes[child_string] = to_check.child;
+            _commit_node(child);
+            minimized_nodes[slot] = child;
+            minimized_count += 1;
+            // keep the load factor at or below one half
+            if (minimized_count * 2 > minimized_nodes.size()) {
+                _grow_register();
+            }
         }
         unchecked_nodes.pop_back();
     }
 }
 
 bool Dawg::lookup(const char* data, std::size_t len) {
-    std::shared_ptr<DawgNode> node = root;
+    int node = static_cast<int>(root);
 
     for (unsigned int i = 0; i < len; i++) {
-        char letter = data[i];
-        if (node->edges.count(letter) == 0) {
+        node = _find_edge(static_cast<unsigned int>(node), static_cast<unsigned char>(data[i]));
+        if (node == -1) {
             return false;
-        } else {
-            node = node->edges[letter];
         }
     }
 
-    if (node->final) {
-        return true;
-    }
-    return false;
+    return nodes[node].final;
 }
 
 bool Dawg::lookup_prefix(const char* data, std::size_t len) {
-    std::shared_ptr<DawgNode> node = root;
+    int node = static_cast<int>(root);
 
     for (unsigned int i = 0; i < len; i++) {
-        char letter = data[i];
-        if (node->edges.count(letter) == 0) {
+        node = _find_edge(static_cast<unsigned int>(node), static_cast<unsigned char>(data[i]));
+        if (node == -1) {
             return false;
-        } else {
-            node = node->edges[letter];
         }
     }
 
     return true;
 }
 
+// Fills this empty dawg with the words of some finished ones, as if they'd
+// been inserted here: nodes that turn up in more than one of them are only
+// stored once. The shards' words must be in order across them, and no two
+// may share a first letter, so that their roots' edges can simply be put
+// side by side under this one's root. Each shard is freed as soon as it has
+// been copied in, so they don't all have to fit alongside the result.
+void Dawg::merge(std::vector<std::unique_ptr<Dawg>>* shards) {
+    std::vector<DawgEdge>& root_edges = pending_edges[nodes[root].first_edge];
+    for (std::unique_ptr<Dawg>& shard : *shards) {
+        std::vector<unsigned int> imported = _import(*shard);
+        for (auto const& edge : shard->edges_of(shard->root)) {
+            root_edges.push_back({edge.letter, imported[edge.child]});
+        }
+        if (!shard->previous_word.empty()) {
+            previous_word = shard->previous_word;
+        }
+        shard.reset();
+    }
+
+    nodes[root].count = 0;
+    _num_reachable(root);
+}
+
+// Copies the nodes below a finished dawg's root into this one, children
+// before parents, registering each unless an equivalent node is already
+// here. Returns the id each of the shard's nodes ended up with.
+std::vector<unsigned int> Dawg::_import(Dawg& shard) {
+    const unsigned int not_imported = 0xffffffff;
+    std::vector<unsigned int> imported(shard.nodes.size(), not_imported);
+    // shard nodes and how many of their edges have been looked at
+    std::vector<std::pair<unsigned int, unsigned int>> stack;
+
+    for (auto const& root_edge : shard.edges_of(shard.root)) {
+        if (imported[root_edge.child] != not_imported) continue;
+        stack.emplace_back(root_edge.child, 0);
+
+        while (!stack.empty()) {
+            unsigned int node = stack.back().first;
+            DawgEdgeRange node_edges = shard.edges_of(node);
+            if (stack.back().second < node_edges.size()) {
+                unsigned int child = node_edges.first[stack.back().second++].child;
+                if (imported[child] == not_imported) {
+                    stack.emplace_back(child, 0);
+                }
+                continue;
+            }
+            stack.pop_back();
+
+            // every child is here now, so the node can be compared with the
+            // ones already registered
+            auto copy = static_cast<unsigned int>(nodes.size());
+            nodes.emplace_back();
+            nodes[copy].final = shard.nodes[node].final;
+            nodes[copy].count = shard.nodes[node].count;
+            nodes[copy].first_edge = static_cast<unsigned int>(edges.size());
+            nodes[copy].edge_count = static_cast<unsigned short>(node_edges.size());
+            for (auto const& edge : node_edges) {
+                edges.push_back({edge.letter, imported[edge.child]});
+            }
+
+            std::size_t slot = _find_slot(copy, _node_hash(copy));
+            if (minimized_nodes[slot] != 0) {
+                imported[node] = minimized_nodes[slot];
+                edges.resize(nodes[copy].first_edge);
+                nodes.pop_back();
+            } else {
+                imported[node] = copy;
+                minimized_nodes[slot] = copy;
+                minimized_count += 1;
+                if (minimized_count * 2 > minimized_nodes.size()) {
+                    _grow_register();
+                }
+            }
+        }
+    }
+    return imported;
+}
+
+// returns the lengths of the prefixes of data that are words, shortest first
+std::vector<std::size_t> Dawg::prefixes_of(const char* data, std::size_t len) {
+    std::vector<std::size_t> lengths;
+    int node = static_cast<int>(root);
+
+    for (unsigned int i = 0; i < len; i++) {
+        node = _find_edge(static_cast<unsigned int>(node), static_cast<unsigned char>(data[i]));
+        if (node == -1) {
+            break;
+        }
+        if (nodes[node].final) {
+            lengths.push_back(i + 1);
+        }
+    }
+
+    return lengths;
+}
+
 unsigned int Dawg::node_count() {
-    return minimized_nodes.size();
+    return minimized_count;
 }
 
 unsigned int Dawg::edge_count() {
-    unsigned int count = 0;
-    for (auto const& min_node : minimized_nodes) {
-        count += min_node.second->edges.size();
-    }
-    return count;
-}
\ No newline at end of file
+    // only minimized nodes have their edges in the arena
+    return static_cast<unsigned int>(edges.size());
+}
@@ -0,0 +1,144 @@
+#include "dawgcache.hpp"
+#include "compact_dawg.hpp"
+#include "crc32c.hpp"
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace dawgcache {
+
+using namespace detail;
+
+CompactDawgView::CompactDawgView(const uint8_t* buffer, std::size_t buffer_length)
+    : header(buffer),
+      data(buffer + DAWG_HEADER_SIZE),
+      length(buffer_length) {
+    // the same checks as validateHeader in index.js
+    if (length < DAWG_HEADER_SIZE) {
+        throw std::invalid_argument("dawg is too short to contain a header");
+    }
+    if (memcmp(header, "dawg", 4) != 0) {
+        throw std::invalid_argument("dawg magic phrase is incorrect");
+    }
+    compact_format format = read_compact_format(header);
+    if (!supported_dawg_version(format.version)) {
+        throw std::invalid_argument("unsupported dawg version");
+    }
+    if (header[5] != 1) {
+        throw std::invalid_argument("only dawgs with one-byte chars are supported");
+    }
+    if (format.node_size != EDGE_COUNT_ONLY && format.node_size != INCLUDES_ENTRY_COUNT && format.node_size != INCLUDES_EDGE_RANKS) {
+        throw std::invalid_argument("unsupported node size");
+    }
+    bool narrow_offsets = format.version >= DAWG_VERSION_VARIABLE_WIDTH && format.offset_width >= 2;
+    if (format.offset_width > 4 || (format.offset_width < 4 && !narrow_offsets)) {
+        throw std::invalid_argument("unsupported offset width");
+    }
+    uint32_t size;
+    memcpy(&size, header + 8, sizeof(uint32_t));
+    if (size != length - DAWG_HEADER_SIZE) {
+        throw std::invalid_argument("dawg size is not as expected");
+    }
+}
+
+bool CompactDawgView::verify() const {
+    uint32_t checksum;
+    memcpy(&checksum, header + 12, sizeof(uint32_t));
+    return crc32c(data, length - DAWG_HEADER_SIZE) == checksum;
+}
+
+unsigned int CompactDawgView::version() const {
+    return read_compact_format(header).version;
+}
+
+bool CompactDawgView::has_counts() const {
+    return has_entry_counts(read_compact_format(header).node_size);
+}
+
+void CompactDawgView::require_counts() const {
+    if (!has_counts()) {
+        throw std::logic_error("counts lookups require a dawg with embedded counts");
+    }
+}
+
+bool CompactDawgView::lookup(const char* key, std::size_t length) const {
+    dawg_search_result result = compact_dawg_search(read_compact_format(header), data, reinterpret_cast<const unsigned char*>(key), length);
+    return result.found && result.final;
+}
+
+bool CompactDawgView::lookup(std::string const& key) const {
+    return lookup(key.data(), key.size());
+}
+
+bool CompactDawgView::lookup_prefix(const char* prefix, std::size_t length) const {
+    return compact_dawg_search(read_compact_format(header), data, reinterpret_cast<const unsigned char*>(prefix), length).found;
+}
+
+bool CompactDawgView::lookup_prefix(std::string const& prefix) const {
+    return lookup_prefix(prefix.data(), prefix.size());
+}
+
+void CompactDawgView::for_each(const char* prefix, std::size_t length, std::function<bool(std::string const&)> const& visit) const {
+    compact_format format = read_compact_format(header);
+    dawg_search_result result = compact_dawg_search(format, data, reinterpret_cast<const unsigned char*>(prefix), length);
+    if (!result.found) return;
+
+    std::string word(prefix, length);
+    if (result.final && !visit(word)) return;
+
+    std::vector<node_position> stack;
+    std::vector<unsigned char> current_word;
+    compact_iterator_start(format, data, result.node_offset, result.tail_index, &stack, &current_word);
+    // the walk appends each word below the prefix to what's left of it
+    while (compact_iterator_next(format, data, &stack, &current_word, &word)) {
+        if (!visit(word)) return;
+        word.resize(length);
+    }
+}
+
+void CompactDawgView::for_each(std::function<bool(std::string const&)> const& visit) const {
+    for_each("", 0, visit);
+}
+
+std::size_t CompactDawgView::size() const {
+    require_counts();
+    return static_cast<std::size_t>(compact_entry_count(read_compact_format(header), data, 0));
+}
+
+CountedLookup CompactDawgView::lookup_counts(const char* key, std::size_t length) const {
+    require_counts();
+    if (length == 0) {
+        // the empty key prefixes every word
+        return {true, false, 0, size()};
+    }
+    dawg_search_result result = counted_compact_dawg_search(read_compact_format(header), data, reinterpret_cast<const unsigned char*>(key), length);
+    if (!result.found) {
+        return {false, false, 0, 0};
+    }
+    return {true, result.final, static_cast<std::size_t>(result.skipped), static_cast<std::size_t>(result.child_count)};
+}
+
+CountedLookup CompactDawgView::lookup_counts(std::string const& key) const {
+    return lookup_counts(key.data(), key.size());
+}
+
+bool CompactDawgView::word_at(std::size_t index, std::string* word) const {
+    require_counts();
+    if (index > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        return false;
+    }
+    dawg_search_result result = inverse_compact_dawg_search(read_compact_format(header), data, static_cast<int>(index));
+    if (!result.found) {
+        return false;
+    }
+    word->assign(*result.match_string);
+    return true;
+}
+
+std::size_t CompactDawgView::lower_bound(const char* key, std::size_t length) const {
+    require_counts();
+    return compact_lower_bound(read_compact_format(header), data, reinterpret_cast<const unsigned char*>(key), length);
+}
+
+} // namespace dawgcache
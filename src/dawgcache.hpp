@@ -0,0 +1,75 @@
+#ifndef DAWGCACHE_HEADER
+#define DAWGCACHE_HEADER 1
+
+// Reads compact dawgs from C++ without node. `make dawgcache` builds this as
+// build/libdawgcache.a; include this header and link against that.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace dawgcache {
+
+// What a counted lookup found: whether the key is a word or a prefix of
+// one, whether it's a word itself, the index of the first word it is a
+// prefix of, and how many words it is a prefix of, itself included.
+struct CountedLookup {
+    bool found;
+    bool final;
+    std::size_t index;
+    std::size_t suffix_count;
+};
+
+// A read-only view of a compact dawg (header included, as builder.cpp
+// writes it) in memory the caller owns, e.g. a mapped file, which has to
+// outlive the view and not change under it. The view has no mutable state
+// and lookups only allocate on their own stack, so any number of threads
+// can use one view, or copies of it, at once.
+class CompactDawgView {
+  public:
+    // Throws std::invalid_argument if the header doesn't describe a compact
+    // dawg of exactly `buffer_length` bytes that can be read. The checksum isn't
+    // checked; see verify().
+    CompactDawgView(const uint8_t* buffer, std::size_t buffer_length);
+
+    // whether the checksum matches, which reads the whole dawg
+    bool verify() const;
+
+    unsigned int version() const;
+    // whether the dawg has entry counts, which the counted methods need
+    bool has_counts() const;
+
+    bool lookup(const char* key, std::size_t length) const;
+    bool lookup(std::string const& key) const;
+    bool lookup_prefix(const char* prefix, std::size_t length) const;
+    bool lookup_prefix(std::string const& prefix) const;
+
+    // Calls `visit` with each word that starts with a prefix (or with
+    // every word), in order, until it returns false.
+    void for_each(const char* prefix, std::size_t length, std::function<bool(std::string const&)> const& visit) const;
+    void for_each(std::function<bool(std::string const&)> const& visit) const;
+
+    // The rest need a dawg with counts, and throw std::logic_error
+    // otherwise.
+
+    // the number of words
+    std::size_t size() const;
+    CountedLookup lookup_counts(const char* key, std::size_t length) const;
+    CountedLookup lookup_counts(std::string const& key) const;
+    // Sets *word to the word at an index; returns false if there isn't one.
+    bool word_at(std::size_t index, std::string* word) const;
+    // the index of the first word that doesn't sort before a key
+    std::size_t lower_bound(const char* key, std::size_t length) const;
+
+  private:
+    const uint8_t* header;
+    const uint8_t* data;
+    std::size_t length;
+
+    void require_counts() const;
+};
+
+} // namespace dawgcache
+
+#endif
@@ -346,4 +346,571 @@ test('Compact DAWG test with embedded counts', function(t) {
     t.assert(compactDawg.lookupPrefixCounts("").found, "compact dawg does contain the empty string as a prefix");
 
     t.end();
-});
\ No newline at end of file
+});
+test('Compact DAWG loaded from a memory-mapped file', function(t) {
+    var fs = require('fs');
+    var os = require('os');
+    var path = require('path');
+
+    var small = new jsdawg.Dawg();
+    ['bar', 'baz', 'foo', 'foobar'].forEach(function(word) { small.insert(word); });
+    small.finish();
+
+    var buf = small.toCompactDawgBuffer(true);
+    var file = path.join(os.tmpdir(), 'dawg-cache-test-' + process.pid + '.dawg');
+    fs.writeFileSync(file, buf);
+
+    ['eager', 'lazy', 'none'].forEach(function(verify) {
+        var mapped = jsdawg.CompactDawg.fromFile(file, {verify: verify});
+        t.assert(mapped.lookup('foobar'), "mapped dawg contains 'foobar' with " + verify + " verification");
+        t.assert(!mapped.lookup('fooba'), "mapped dawg does not contain 'fooba' with " + verify + " verification");
+        t.equal(mapped.lookupCounts('foo').index, 2, "mapped dawg has counts with " + verify + " verification");
+    });
+    t.assert(jsdawg.CompactDawg.fromFile(file).lookup('baz'), "verification defaults to eager");
+
+    var corrupted = Buffer.from(buf);
+    corrupted[corrupted.length - 1] ^= 0xff;
+    fs.writeFileSync(file, corrupted);
+
+    t.throws(function() { jsdawg.CompactDawg.fromFile(file, {verify: 'eager'}); }, /checksum is not correct/, "eager verification rejects a corrupt file");
+    t.throws(function() { jsdawg.CompactDawg.fromFile(file, {verify: 'sometimes'}); }, /verify must be one of/, "validates verify option");
+    t.throws(function() { jsdawg.CompactDawg.fromFile(file + '.missing'); }, /could not open/, "fails on a missing file");
+    t.assert(jsdawg.CompactDawg.fromFile(file, {verify: 'none'}), "no verification accepts a corrupt file");
+
+    var unhandled = 0;
+    function onUnhandled() { unhandled++; }
+    process.on('unhandledRejection', onUnhandled);
+    jsdawg.CompactDawg.fromFile(file, {verify: 'lazy'});
+
+    jsdawg.CompactDawg.fromFile(file, {verify: 'lazy'}).verified.then(function() {
+        t.fail("lazy verification should reject a corrupt file");
+    }, function(err) {
+        t.assert(/checksum is not correct/.test(err.message), "lazy verification rejects a corrupt file");
+    }).then(function() {
+        // give the ignored check time to fail too
+        setTimeout(function() {
+            process.removeListener('unhandledRejection', onUnhandled);
+            t.equal(unhandled, 0, "an ignored lazy verification doesn't leave an unhandled rejection");
+            fs.unlinkSync(file);
+            t.end();
+        }, 100);
+    });
+});
+
+// Checks that a compact dawg built from `words` finds all of them and their
+// prefixes, and nothing else, iterates over them in order and, if it has
+// counts, maps them to and from their indexes.
+function checkCompactRoundTrip(t, compactDawg, label, preserveCounts) {
+    var exactLookup = true;
+    var prefixLookup = true;
+    var lookupFailure = true;
+    for (var i = 0; i < words.length; i++) {
+        exactLookup = exactLookup && compactDawg.lookup(words[i]);
+        prefixLookup = prefixLookup && compactDawg.lookupPrefix(words[i].substring(0, words[i].length - 1));
+        lookupFailure = lookupFailure && !compactDawg.lookup(words[i] + "qzz");
+    }
+    t.assert(exactLookup, label + " compact dawg contains all words");
+    t.assert(prefixLookup, label + " compact dawg contains prefixes of all words as prefixes");
+    t.assert(lookupFailure, label + " compact dawg does not contain words with 'qzz' added");
+
+    var compactDawgWords = [];
+    forOf(compactDawg, function(value) { compactDawgWords.push(value); });
+    t.deepEqual(compactDawgWords, words, label + " compact dawg iterator reproduces original list");
+
+    if (preserveCounts) {
+        var exactIndexes = true;
+        var inverseText = true;
+        for (var i = 0; i < words.length; i++) {
+            exactIndexes = exactIndexes && (compactDawg.lookupCounts(words[i]).index == i);
+            inverseText = inverseText && (compactDawg.lookupCounts(i).text == words[i]);
+        }
+        t.assert(exactIndexes, label + " compact dawg's indexes match insertion word order");
+        t.assert(inverseText, label + " compact dawg lookup by index retrieves all words");
+    }
+}
+
+test('Compact DAWG test with variable-width offsets (version 3)', function(t) {
+    [false, true].forEach(function(preserveCounts) {
+        var buf = dawg.toCompactDawgBuffer(preserveCounts, 3);
+        t.equal(buf[4], 3, "buffer has version 3");
+        t.assert(buf.length <= dawg.toCompactDawgBuffer(preserveCounts).length, "version 3 is no bigger than version 1");
+        var compactDawg = dawg.toCompactDawg(preserveCounts, 3);
+
+        checkCompactRoundTrip(t, compactDawg, "version 3", preserveCounts);
+    });
+
+    var small = new jsdawg.Dawg();
+    ['bar', 'baz', 'foo', 'foobar'].forEach(function(word) { small.insert(word); });
+    small.finish();
+    var smallBuf = small.toCompactDawgBuffer(true, 3);
+    t.equal(smallBuf[7], 2, "small dawgs get two-byte offsets");
+    var smallCompact = new jsdawg.CompactDawg(smallBuf);
+    t.equal(smallCompact.lookupCounts('foobar').index, 3, "two-byte offsets keep counts");
+    t.deepEqual(Array.prototype.slice.call(smallCompact.lookupMany(['foo', 'fo', 'qux'])), [1, 0, 0], "two-byte offsets work in batches");
+    t.end();
+});
+
+test('Compact DAWG test with tails (version 4)', function(t) {
+    [false, true].forEach(function(preserveCounts) {
+        var buf = dawg.toCompactDawgBuffer(preserveCounts, 4);
+        t.equal(buf[4], 4, "buffer has version 4");
+        t.assert(buf.length < dawg.toCompactDawgBuffer(preserveCounts, 3).length, "tails make the dawg smaller than version 3");
+        var compactDawg = dawg.toCompactDawg(preserveCounts, 4);
+
+        checkCompactRoundTrip(t, compactDawg, "version 4", preserveCounts);
+    });
+
+    // long single-child chains, ending part way through a tail
+    var chains = new jsdawg.Dawg();
+    ['abcdefghij', 'abcdefghijklm', 'abcxyz', 'qrstuvwxyz'].forEach(function(word) { chains.insert(word); });
+    chains.finish();
+    var tailDawg = chains.toCompactDawg(true, 4);
+    t.assert(tailDawg.lookupPrefix('abcde'), "prefixes ending inside a tail are found");
+    t.assert(!tailDawg.lookup('abcde'), "words ending inside a tail aren't final");
+    t.assert(!tailDawg.lookupPrefix('abcdeg'), "mismatches inside a tail aren't found");
+    t.assert(tailDawg.lookup('qrstuvwxyz'), "whole tails are found");
+    t.deepEqual(tailDawg.lookupPrefixCounts('qrst'), {found: true, index: 3, suffixCount: 1, text: 'qrst'}, "counts inside a tail");
+    t.deepEqual(tailDawg.lookupPrefixCounts('abcdefghijk'), {found: true, index: 1, suffixCount: 1, text: 'abcdefghijk'}, "counts inside a tail below a final node");
+    var suffixes = [];
+    var suffixIterator = tailDawg.iterator('abcdef');
+    for (var next = suffixIterator.next(); !next.done; next = suffixIterator.next()) suffixes.push(next.value);
+    t.deepEqual(suffixes, ['abcdefghij', 'abcdefghijklm'], "iterates from inside a tail");
+    var batch = ['abcdefghij', 'abcdefg', 'abcdefgx', 'qrstuvwxy'];
+    t.deepEqual(Array.prototype.slice.call(tailDawg.lookupMany(batch)), [1, 0, 0, 0], "tails work in exact batches");
+    t.deepEqual(Array.prototype.slice.call(tailDawg.lookupMany(batch, {mode: 'prefix'})), [1, 1, 0, 1], "tails work in prefix batches");
+    t.end();
+});
+
+test('Compact DAWG test with the hybrid layout', function(t) {
+    [false, true].forEach(function(preserveCounts) {
+        var buf = dawg.toCompactDawgBuffer(preserveCounts, 1, jsdawg.LAYOUTS.hybrid);
+        t.equal(buf.length, dawg.toCompactDawgBuffer(preserveCounts).length, "hybrid layout is the same size as depth-first");
+        var compactDawg = dawg.toCompactDawg(preserveCounts, 1, jsdawg.LAYOUTS.hybrid);
+
+        checkCompactRoundTrip(t, compactDawg, "hybrid layout", preserveCounts);
+    });
+    t.throws(function() { dawg.toCompactDawgBuffer(false, 1, 7); }, /unsupported dawg layout/, "validates layout");
+    t.end();
+});
+
+test('Compact DAWG test with edge ranks', function(t) {
+    [1, 4].forEach(function(version) {
+        var buf = dawg.toCompactDawgBuffer(false, version, jsdawg.LAYOUTS.depthFirst, true);
+        t.equal(buf[6], 9, "version " + version + " buffer has nine-byte node headers");
+        var compactDawg = dawg.toCompactDawg(false, version, jsdawg.LAYOUTS.depthFirst, true);
+        var countedDawg = dawg.toCompactDawg(true, version);
+
+        var exactIndexes = true;
+        var inverseText = true;
+        var prefixCounts = true;
+        for (var i = 0; i < words.length; i++) {
+            exactIndexes = exactIndexes && (compactDawg.lookupCounts(words[i]).index == i);
+            inverseText = inverseText && (compactDawg.lookupCounts(i).text == words[i]);
+            var prefix = words[i].substring(0, 3);
+            prefixCounts = prefixCounts && (JSON.stringify(compactDawg.lookupPrefixCounts(prefix)) == JSON.stringify(countedDawg.lookupPrefixCounts(prefix)));
+        }
+        t.assert(exactIndexes, "version " + version + " ranked compact dawg's indexes match insertion word order");
+        t.assert(inverseText, "version " + version + " ranked compact dawg lookup by index retrieves all words");
+        t.assert(prefixCounts, "version " + version + " ranked compact dawg prefix counts match the unranked dawg");
+
+        var compactDawgWords = [];
+        forOf(compactDawg, function(value) { compactDawgWords.push(value); });
+        t.deepEqual(compactDawgWords, words, "version " + version + " ranked compact dawg iterator reproduces original list");
+    });
+    t.end();
+});
+
+test('Compact DAWG batch index decoding', function(t) {
+    var ids = new Uint32Array(words.length);
+    for (var i = 0; i < words.length; i++) ids[i] = i;
+    [[true, 1, false], [true, 4, false], [false, 3, true]].forEach(function(args) {
+        var compactDawg = dawg.toCompactDawg(args[0], args[1], jsdawg.LAYOUTS.depthFirst, args[2]);
+        t.deepEqual(compactDawg.decodeIndices(ids), words, "version " + args[1] + " decodes every index in order");
+        t.deepEqual(compactDawg.decodeIndices([words.length - 1, 0, words.length, 5, 5]), [words[words.length - 1], words[0], null, words[5], words[5]], "version " + args[1] + " decodes unsorted indexes, with null past the end");
+    });
+    t.deepEqual(dawg.toCompactDawg(true).decodeIndices([]), [], "decodes an empty list");
+    t.deepEqual(dawg.toCompactDawg(true).decodeIndices([0xFFFFFFFF]), [null], "decodes the largest index to null");
+    t.throws(function() { dawg.toCompactDawg().decodeIndices([0]); }, /embedded counts/, "requires counts");
+    t.throws(function() { dawg.toCompactDawg(true).decodeIndices([-1]); }, /non-negative integers/, "validates indexes");
+    t.end();
+});
+
+test('Compact DAWG counted lookups into typed arrays', function(t) {
+    [[1, false], [4, false], [1, true]].forEach(function(args) {
+        var compactDawg = dawg.toCompactDawg(true, args[0], jsdawg.LAYOUTS.depthFirst, args[1]);
+        var out = new Int32Array(3);
+        var matches = true;
+        for (var i = 0; i < words.length; i++) {
+            var status = compactDawg.lookupCountsInto(words[i], out);
+            var expected = compactDawg.lookupCounts(words[i]);
+            matches = matches && status == 2 && out[0] == 2 && out[1] == expected.index && out[2] == expected.suffixCount;
+        }
+        t.assert(matches, "version " + args[0] + " counted lookups into an Int32Array match lookupCounts");
+
+        var prefix = words[10].substring(0, 2);
+        var prefixCounts = compactDawg.lookupPrefixCounts(prefix);
+        t.equal(compactDawg.lookupCountsInto(prefix, out), 1, "prefixes have status 1");
+        t.deepEqual(Array.prototype.slice.call(out), [1, prefixCounts.index, prefixCounts.suffixCount], "prefix counts");
+        t.equal(compactDawg.lookupCountsInto(words[0] + "qzz", out), 0, "missing keys have status 0");
+        t.deepEqual(Array.prototype.slice.call(out), [0, -1, 0], "missing key counts");
+
+        var batch = new Int32Array(12);
+        var keys = [words[0], prefix, "qzz", words[words.length - 1]];
+        t.equal(compactDawg.lookupManyCountsInto(keys, batch), 4, "batch returns the number of keys");
+        t.deepEqual(Array.prototype.slice.call(batch), [2, 0, compactDawg.lookupCounts(words[0]).suffixCount, 1, prefixCounts.index, prefixCounts.suffixCount, 0, -1, 0, 2, words.length - 1, 1], "batched counts");
+        compactDawg.lookupManyCountsInto(Buffer.from(keys.join("\n")), batch);
+        t.deepEqual(Array.prototype.slice.call(batch, 0, 3), [2, 0, compactDawg.lookupCounts(words[0]).suffixCount], "batched counts from a buffer");
+        t.throws(function() { compactDawg.lookupManyCountsInto(keys, new Int32Array(11)); }, /3 values per key/, "checks the output size");
+    });
+    t.deepEqual((function() { var out = new Int32Array(3); dawg.toCompactDawg(true).lookupCountsInto("", out); return Array.prototype.slice.call(out); })(), [1, 0, words.length], "the empty key prefixes every word");
+    t.throws(function() { dawg.toCompactDawg().lookupCountsInto(words[0], new Int32Array(3)); }, /embedded counts/, "requires counts");
+    t.end();
+});
+
+test('Compact DAWG ranged iteration', function(t) {
+    function collect(iterator) {
+        var out = [];
+        for (var next = iterator.next(); !next.done; next = iterator.next()) out.push(next.value);
+        return out;
+    }
+
+    [[1, false], [4, false], [3, true]].forEach(function(args) {
+        var compactDawg = dawg.toCompactDawg(true, args[0], jsdawg.LAYOUTS.depthFirst, args[1]);
+        var name = "version " + args[0] + (args[1] ? " with ranks" : "");
+        t.deepEqual(collect(compactDawg.iterator({})), words, name + " empty range covers every word");
+        t.deepEqual(collect(compactDawg.iterator({from: 1000, limit: 600})), words.slice(1000, 1600), name + " pages from an index");
+        t.deepEqual(collect(compactDawg.iterator({from: 10, to: 15})), words.slice(10, 15), name + " stops at `to`");
+        t.deepEqual(collect(compactDawg.iterator({from: words.length - 3})), words.slice(words.length - 3), name + " runs to the end");
+        t.deepEqual(collect(compactDawg.iterator({from: words.length})), [], name + " is empty past the end");
+        t.deepEqual(collect(compactDawg.iterator({from: 20, to: 10})), [], name + " is empty for reversed ranges");
+        t.deepEqual(collect(compactDawg.iterator({from: words[500], to: words[510]})), words.slice(500, 510), name + " ranges between keys");
+        t.deepEqual(collect(compactDawg.iterator({from: words[500] + "\u0001", limit: 2})), words.slice(501, 503), name + " starts after keys that aren't in the dawg");
+    });
+    t.throws(function() { dawg.toCompactDawg().iterator({from: 1}); }, /embedded counts/, "requires counts");
+    t.end();
+});
+
+test('Compact DAWG iterator batches', function(t) {
+    var compactDawg = dawg.toCompactDawg(true);
+    t.equal(compactDawg.iterator().toBuffer().toString(), words.join("\n") + "\n", "toBuffer dumps every word");
+
+    var it = compactDawg.iterator();
+    var batches = [];
+    for (var batch = it.nextBatch(1000); batch !== undefined; batch = it.nextBatch(1000)) batches.push(batch);
+    t.equal(batches.length, Math.ceil(words.length / 1000), "batches hold up to the given number of words");
+    t.equal(Buffer.concat(batches).toString(), words.join("\n") + "\n", "batches cover every word");
+
+    var testWords = words.filter(function(word) { return word.indexOf("test") == 0; });
+    var prefixIt = compactDawg.iterator("test");
+    t.equal(prefixIt.next().value, testWords[0], "prefix iterators can mix next and batches");
+    t.equal(prefixIt.nextBatch(2).toString(), testWords.slice(1, 3).join("\n") + "\n", "prefix batches include the prefix");
+    t.equal(prefixIt.toBuffer().toString(), testWords.slice(3).join("\n") + "\n", "prefix toBuffer dumps the rest");
+    t.equal(prefixIt.nextBatch(2), undefined, "batches run out");
+
+    var rangeIt = compactDawg.iterator({from: 100, limit: 600});
+    t.equal(rangeIt.next().value, words[100], "ranged iterators can mix next and batches");
+    t.equal(rangeIt.nextBatch(300).toString(), words.slice(101, 401).join("\n") + "\n", "ranged batches start after words already returned");
+    t.equal(rangeIt.toBuffer().toString(), words.slice(401, 700).join("\n") + "\n", "ranged toBuffer stops at the limit");
+    t.end();
+});
+
+test('Compact DAWG fuzzy lookups', function(t) {
+    var small = new jsdawg.Dawg();
+    ['cat', 'cats', 'coat', 'cot', 'cut', 'dog', 'scat'].forEach(function(word) { small.insert(word); });
+    small.finish();
+
+    [false, true].forEach(function(preserveCounts) {
+        [1, 4].forEach(function(version) {
+            var name = "version " + version + (preserveCounts ? " with counts" : "");
+            var compactDawg = small.toCompactDawg(preserveCounts, version);
+            var texts = function(matches) { return matches.map(function(match) { return match.text + ":" + match.distance; }); };
+
+            t.deepEqual(texts(compactDawg.fuzzyLookup('cat', 0)), ['cat:0'], name + " zero edits is an exact lookup");
+            t.deepEqual(texts(compactDawg.fuzzyLookup('cat', 1)), ['cat:0', 'cats:1', 'coat:1', 'cot:1', 'cut:1', 'scat:1'], name + " one edit, closest first");
+            t.deepEqual(texts(compactDawg.fuzzyLookup('cat', 1, {limit: 3})), ['cat:0', 'cats:1', 'coat:1'], name + " limits matches");
+            t.deepEqual(texts(compactDawg.fuzzyLookup('dgo', 2)), ['dog:2'], name + " transpositions take two edits");
+            t.deepEqual(texts(compactDawg.fuzzyLookup('ca', 0, {prefix: true})), ['cat:0', 'cats:0'], name + " prefix mode");
+            t.deepEqual(texts(compactDawg.fuzzyLookup('xyz', 1)), [], name + " finds nothing out of reach");
+            if (preserveCounts) {
+                t.deepEqual(compactDawg.fuzzyLookup('cot', 0), [{text: 'cot', distance: 0, index: 3}], name + " includes indexes");
+            } else {
+                t.deepEqual(compactDawg.fuzzyLookup('cot', 0), [{text: 'cot', distance: 0}], name + " leaves out indexes");
+            }
+        });
+    });
+
+    var compactDawg = dawg.toCompactDawg(true, 4);
+    // distances are in bytes, so misspell an ascii word
+    var sampleIndex = 1234;
+    while (!/^[ -~]{3,}$/.test(words[sampleIndex])) sampleIndex++;
+    var sample = words[sampleIndex];
+    var misspelled = sample.substring(0, 1) + "#" + sample.substring(2);
+    var matches = compactDawg.fuzzyLookup(misspelled, 1);
+    t.assert(matches.some(function(match) { return match.text == sample && match.index == sampleIndex && match.distance == 1; }), "finds a misspelled word in the full dawg");
+    t.throws(function() { compactDawg.fuzzyLookup(sample, -1); }, /non-negative integer/, "validates maxEdits");
+    t.end();
+});
+
+test('Compact DAWG top completions', function(t) {
+    // a deterministic, unsorted score for every word
+    var scores = new Uint32Array(words.length);
+    for (var i = 0; i < words.length; i++) scores[i] = (i * 7919) % 1000;
+    var table = jsdawg.buildScoreTable(scores);
+
+    function expected(prefix, limit) {
+        var matches = [];
+        for (var i = 0; i < words.length; i++) {
+            if (words[i].indexOf(prefix) == 0) matches.push({text: words[i], index: i, score: scores[i]});
+        }
+        matches.sort(function(a, b) { return b.score - a.score || a.index - b.index; });
+        return matches.slice(0, limit);
+    }
+
+    [[1, false], [4, false], [4, true]].forEach(function(args) {
+        var name = "version " + args[0] + (args[1] ? " with ranks" : "");
+        var compactDawg = dawg.toCompactDawg(true, args[0], jsdawg.LAYOUTS.depthFirst, args[1]);
+        compactDawg.setScores(table);
+        t.deepEqual(compactDawg.complete("", 10), expected("", 10), name + " best words overall");
+        t.deepEqual(compactDawg.complete("te", 5), expected("te", 5), name + " best completions of a prefix");
+        t.deepEqual(compactDawg.complete("test", 200), expected("test", 200), name + " all completions when there are fewer than the limit");
+        t.deepEqual(compactDawg.complete("qzzq", 5), [], name + " no completions for missing prefixes");
+    });
+
+    t.deepEqual(jsdawg.buildScoreTable([1, 2, 3]), jsdawg.buildScoreTable(new Uint32Array([1, 2, 3])), "takes Arrays of scores");
+    t.throws(function() { dawg.toCompactDawg(true).setScores(jsdawg.buildScoreTable([1, 2, 3])); }, /a score for each entry/, "checks the table's size");
+    t.throws(function() { dawg.toCompactDawg(true).setScores(Buffer.from("not a table")); }, /not a valid score table/, "checks the table");
+    t.throws(function() { dawg.toCompactDawg().setScores(table); }, /embedded counts/, "requires counts");
+    t.throws(function() { dawg.toCompactDawg(true).complete("te", 5); }, /setScores/, "requires scores");
+    t.end();
+});
+
+test('DAWG prefixes of a key', function(t) {
+    var small = new jsdawg.Dawg();
+    ['a', 'an', 'and', 'android', 'ant', 'caf\u00e9', 'caf\u00e9s'].forEach(function(word) { small.insert(word); });
+    t.deepEqual(small.prefixesOf('andromeda'), [{text: 'a', length: 1}, {text: 'an', length: 2}, {text: 'and', length: 3}], "Dawg finds prefixes before it's finished");
+    small.finish();
+    t.deepEqual(small.longestPrefixOf('androids'), {text: 'android', length: 7}, "Dawg finds the longest prefix");
+    t.equal(small.longestPrefixOf('bee'), null, "Dawg returns null without a prefix");
+
+    [[false, 1], [true, 1], [true, 4]].forEach(function(args) {
+        var name = "version " + args[1] + (args[0] ? " with counts" : "");
+        var compactDawg = small.toCompactDawg(args[0], args[1]);
+        var strip = function(matches) {
+            return matches.map(function(match) { return args[0] ? match : {text: match.text, length: match.length}; });
+        };
+        t.deepEqual(compactDawg.prefixesOf('android'), strip([{text: 'a', length: 1, index: 0}, {text: 'an', length: 2, index: 1}, {text: 'and', length: 3, index: 2}, {text: 'android', length: 7, index: 3}]), name + " finds every prefix");
+        t.deepEqual(compactDawg.longestPrefixOf('caf\u00e9sx'), strip([{text: 'caf\u00e9s', length: 6, index: 6}])[0], name + " counts lengths in bytes");
+        t.deepEqual(compactDawg.prefixesOf('bee'), [], name + " finds nothing without a prefix");
+        t.equal(compactDawg.longestPrefixOf(''), null, name + " the empty key has no prefixes");
+    });
+    t.end();
+});
+
+test('Compact DAWG built from a file on the threadpool', function(t) {
+    var fs = require('fs');
+    var os = require('os');
+    var path = require('path');
+
+    var file = path.join(os.tmpdir(), 'dawg-cache-build-' + process.pid + '.txt');
+    fs.writeFileSync(file, words.join('\n') + '\n');
+
+    var unsorted = path.join(os.tmpdir(), 'dawg-cache-unsorted-' + process.pid + '.txt');
+    fs.writeFileSync(unsorted, 'foo\nbar\n');
+
+    // every word backwards, and every tenth one twice
+    var shuffled = path.join(os.tmpdir(), 'dawg-cache-shuffled-' + process.pid + '.txt');
+    fs.writeFileSync(shuffled, words.slice().reverse().concat(words.filter(function(word, i) { return i % 10 == 0; })).join('\n') + '\n');
+
+    var out = path.join(os.tmpdir(), 'dawg-cache-built-' + process.pid + '.dawg');
+
+    jsdawg.buildCompactDawgFromFile(file).then(function(buf) {
+        t.deepEqual(buf, dawg.toCompactDawgBuffer(false), "matches the buffer built on the main thread");
+        return jsdawg.buildCompactDawgFromFile(file, {counts: true, version: 2});
+    }).then(function(buf) {
+        t.deepEqual(buf, dawg.toCompactDawgBuffer(true, 2), "preserves counts and version");
+        var compactDawg = new jsdawg.CompactDawg(buf);
+        t.equal(compactDawg.lookupCounts(words[10]).index, 10, "built dawg has counts");
+        return jsdawg.buildCompactDawgFromFile(file, {counts: true, threads: 4});
+    }).then(function(buf) {
+        t.deepEqual(buf, dawg.toCompactDawgBuffer(true), "builds the same dawg on several threads");
+        return jsdawg.buildCompactDawgFromFile(unsorted);
+    }).then(function() {
+        t.fail("unsorted input should be rejected");
+    }, function(err) {
+        t.assert(/Entries must be inserted in order/.test(err.message), "rejects unsorted input");
+        return jsdawg.buildCompactDawgFromFile(unsorted, {threads: 4});
+    }).then(function() {
+        t.fail("unsorted input should be rejected when sharded");
+    }, function(err) {
+        t.assert(/Entries must be inserted in order/.test(err.message), "rejects unsorted input across shards");
+        return jsdawg.buildCompactDawgFromFile(shuffled, {counts: true, unsorted: true, sortMemory: 4096});
+    }).then(function(buf) {
+        t.deepEqual(buf, dawg.toCompactDawgBuffer(true), "sorts and deduplicates unsorted input in runs");
+        return jsdawg.buildCompactDawgFromFile(shuffled, {counts: true, unsorted: true, sortMemory: 4096, tempDir: os.tmpdir()});
+    }).then(function(buf) {
+        t.deepEqual(buf, dawg.toCompactDawgBuffer(true), "spills sorted runs to tempDir");
+        return jsdawg.buildCompactDawgFromFile(shuffled, {unsorted: true, sortMemory: 4096, tempDir: path.join(os.tmpdir(), 'dawg-cache-missing-' + process.pid)});
+    }).then(function() {
+        t.fail("a missing tempDir should be rejected");
+    }, function(err) {
+        t.assert(/could not sort/.test(err.message), "rejects a missing tempDir");
+        return jsdawg.buildCompactDawgFromFile(file + '.missing');
+    }).then(function() {
+        t.fail("a missing file should be rejected");
+    }, function(err) {
+        t.assert(/could not open/.test(err.message), "rejects a missing file");
+        return jsdawg.buildCompactDawgFromFile(file, {version: 9});
+    }).then(function() {
+        t.fail("an unsupported version should be rejected");
+    }, function(err) {
+        t.assert(/unsupported dawg version/.test(err.message), "validates version");
+        return jsdawg.buildCompactDawgFile(file, out, {counts: true});
+    }).then(function() {
+        t.deepEqual(fs.readFileSync(out), dawg.toCompactDawgBuffer(true), "streams the same dawg to a file");
+        t.equal(jsdawg.CompactDawg.fromFile(out).lookupCounts(words[10]).index, 10, "streamed file loads and has counts");
+        return jsdawg.buildCompactDawgFile(file, path.join(out + '.missing', 'out.dawg'));
+    }).then(function() {
+        t.fail("an unwritable output path should be rejected");
+    }, function(err) {
+        t.assert(/could not open/.test(err.message), "rejects an unwritable output path");
+        t.throws(function() { jsdawg.buildCompactDawgFile(file); }, /outPath must be a non-empty string/, "validates outPath");
+        fs.unlinkSync(file);
+        fs.unlinkSync(out);
+        fs.unlinkSync(unsorted);
+        fs.unlinkSync(shuffled);
+        t.end();
+    });
+});
+
+test('Compact DAWG batch lookups', function(t) {
+    var small = new jsdawg.Dawg();
+    ['bar', 'baz', 'foo', 'foobar', 'zürich'].forEach(function(word) { small.insert(word); });
+    small.finish();
+
+    var keys = ['foo', 'fo', 'foobar', 'qux', '', 'zürich', 'bazz'];
+    [false, true].forEach(function(preserveCounts) {
+        var compactDawg = small.toCompactDawg(preserveCounts);
+
+        var exact = compactDawg.lookupMany(keys);
+        t.assert(exact instanceof Uint8Array, "exact lookups return a Uint8Array");
+        t.deepEqual(Array.prototype.slice.call(exact), [1, 0, 1, 0, 0, 1, 0], "exact lookups match lookup()");
+        t.deepEqual(Array.prototype.slice.call(compactDawg.lookupMany(keys, {mode: 'exact'})), [1, 0, 1, 0, 0, 1, 0], "exact is the default mode");
+
+        var prefix = compactDawg.lookupMany(keys, {mode: 'prefix'});
+        t.deepEqual(Array.prototype.slice.call(prefix), [1, 1, 1, 0, 1, 1, 0], "prefix lookups match lookupPrefix()");
+
+        var fromBuffer = compactDawg.lookupMany(Buffer.from(keys.join('\n') + '\n'), {mode: 'prefix'});
+        t.deepEqual(Array.prototype.slice.call(fromBuffer), [1, 1, 1, 0, 1, 1, 0], "newline-delimited buffer keys match array keys");
+        t.equal(compactDawg.lookupMany(Buffer.from('foo\nbar')).length, 2, "last buffer key needs no trailing newline");
+        t.equal(compactDawg.lookupMany([]).length, 0, "empty batches are allowed");
+    });
+
+    var counted = small.toCompactDawg(true);
+    var indexes = counted.lookupMany(keys, {mode: 'counts'});
+    t.assert(indexes instanceof Int32Array, "counts lookups return an Int32Array");
+    t.deepEqual(Array.prototype.slice.call(indexes), [2, -1, 3, -1, -1, 4, -1], "counts lookups return word indexes");
+
+    t.throws(function() { small.toCompactDawg(false).lookupMany(keys, {mode: 'counts'}); }, /require a dawg with embedded counts/, "counts lookups need counts");
+    t.throws(function() { counted.lookupMany(keys, {mode: 'fuzzy'}); }, /mode must be one of/, "validates mode");
+    t.throws(function() { counted.lookupMany(['foo', 1]); }, /keys must be Strings/, "validates keys");
+    t.throws(function() { counted.lookupMany('foo'); }, /Array of Strings or a Buffer/, "validates input");
+    t.end();
+});
+
+test('Compact DAWG set lookups', function(t) {
+    var sources = [['bar', 'baz', 'foo'], ['foo', 'foobar'], [], ['zürich']];
+    var buffers = sources.map(function(list, i) {
+        var d = new jsdawg.Dawg();
+        list.forEach(function(word) { d.insert(word); });
+        d.finish();
+        return d.toCompactDawgBuffer(i % 2 == 1, i + 1);
+    });
+    var set = new jsdawg.CompactDawgSet(buffers);
+    t.equal(set.size, 4, "holds every dawg");
+
+    t.equal(set.lookup('foo'), 3, "exact lookups return a mask of the dawgs with the word");
+    t.equal(set.lookup('foob'), 0, "prefixes aren't words");
+    t.equal(set.lookupPrefix('foob'), 2, "prefix lookups match prefixes");
+    t.equal(set.lookup('zürich'), 8, "looks up utf8 keys");
+    t.equal(set.lookupPrefix(''), 15, "the empty key prefixes every dawg");
+
+    var keys = ['foo', 'ba', 'qux', 'zürich', 'foobar'];
+    t.deepEqual(Array.prototype.slice.call(set.lookupMany(keys)), [3, 0, 0, 8, 2], "batch exact lookups");
+    t.deepEqual(Array.prototype.slice.call(set.lookupMany(Buffer.from(keys.join('\n')), {mode: 'prefix'})), [3, 1, 0, 8, 2], "batch prefix lookups of a buffer");
+
+    t.equal(new jsdawg.CompactDawgSet([]).lookupPrefix('a'), 0, "an empty set matches nothing");
+    t.throws(function() { new jsdawg.CompactDawgSet(new Array(33).fill(buffers[0])); }, /at most 32/, "holds at most 32 dawgs");
+    t.throws(function() { set.lookupMany(keys, {mode: 'counts'}); }, /mode must be/, "validates mode");
+    t.end();
+});
+
+test('Compact DAWG test with split edges (version 2)', function(t) {
+    [false, true].forEach(function(preserveCounts) {
+        var buf = dawg.toCompactDawgBuffer(preserveCounts, 2);
+        t.equal(buf[4], 2, "buffer has version 2");
+        var compactDawg = dawg.toCompactDawg(preserveCounts, 2);
+
+        checkCompactRoundTrip(t, compactDawg, "version 2", preserveCounts);
+        if (preserveCounts) {
+            t.assert(!compactDawg.lookupCounts(words.length).found, "out of range indexes are not found");
+        }
+    });
+    t.throws(function() { dawg.toCompactDawgBuffer(false, 9); }, /unsupported dawg version/, "validates version");
+    t.end();
+});
+
+test('DAWG overlay', function(t) {
+    var base = new jsdawg.Dawg();
+    ['bar', 'baz', 'foo', 'foobar', 'zürich'].forEach(function(word) { base.insert(word); });
+    base.finish();
+
+    var overlay = new jsdawg.DawgOverlay(base.toCompactDawgBuffer(true, 3));
+    t.assert(overlay.add('food'), "adds a new word");
+    t.assert(!overlay.add('foo'), "doesn't add a word that's there");
+    t.assert(overlay.delete('baz'), "deletes a base word");
+    t.assert(overlay.delete('food'), "deletes an added word");
+    t.assert(!overlay.delete('qux'), "doesn't delete a missing word");
+    overlay.add('bat');
+    overlay.add('😀');
+    overlay.delete('zürich');
+
+    var expected = ['bar', 'bat', 'foo', 'foobar', '😀'];
+    t.assert(overlay.lookup('bat') && !overlay.lookup('baz') && !overlay.lookup('food'), "lookups see the changes");
+    t.assert(overlay.lookupPrefix('fo') && !overlay.lookupPrefix('z') && overlay.lookupPrefix('😀'), "prefix lookups see the changes");
+
+    var seen = [];
+    forOf(overlay, function(value) { seen.push(value); });
+    t.deepEqual(seen, expected, "iterates over the combined words in order");
+    var prefixed = [];
+    var it = overlay.iterator('ba');
+    for (var n = it.next(); !n.done; n = it.next()) prefixed.push(n.value);
+    t.deepEqual(prefixed, ['bar', 'bat'], "iterates over a prefix");
+
+    t.equal(overlay.size(), expected.length, "counts the combined words");
+    t.deepEqual(expected.map(function(word) { return overlay.lookupCounts(word).index; }), [0, 1, 2, 3, 4], "indexes follow the combined order");
+    t.equal(overlay.lookupPrefixCounts('foo').suffixCount, 2, "suffix counts see the changes");
+    t.assert(!overlay.lookupCounts('baz').found, "deleted words have no counts");
+
+    var rebuilt = new jsdawg.Dawg();
+    expected.forEach(function(word) { rebuilt.insert(word); });
+    rebuilt.finish();
+
+    var compaction = overlay.compact();
+    overlay.add('qux');
+    compaction.then(function(buf) {
+        t.deepEqual(buf, rebuilt.toCompactDawgBuffer(true, 3), "compaction writes the combined words in the base's format");
+        t.deepEqual(overlay.added, ['qux'], "changes made during compaction stay in the overlay");
+        t.deepEqual(overlay.deleted, [], "compacted changes leave the overlay");
+        t.assert(overlay.lookup('qux') && overlay.lookup('bat') && !overlay.lookup('baz'), "lookups are unchanged by compaction");
+
+        var compacted;
+        var automatic = new jsdawg.DawgOverlay(buf, {compactThreshold: 2, onCompact: function(err, newBuf) {
+            t.error(err, "compacts in the background");
+            t.assert(new jsdawg.CompactDawg(newBuf).lookup('new'), "the compacted buffer has the changes");
+            t.equal(automatic.added.length + automatic.deleted.length, 0, "nothing is left in the overlay");
+            t.end();
+        }});
+        automatic.add('new');
+        automatic.delete('bar');
+    });
+});
@@ -0,0 +1,185 @@
+// Tests for the C++ library (src/dawgcache.hpp), run by `make test-dawgcache`.
+// Builds dawgs of every version and node size with builder.cpp and checks
+// the view against the word list they were built from.
+
+#include "../src/builder.cpp"
+#include "../src/dawgcache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<unsigned int> failures(0);
+
+void check(bool ok, std::string const& label, std::string const& message) {
+    if (!ok) {
+        failures += 1;
+        std::cerr << "not ok - " << label << ": " << message << "\n";
+    }
+}
+
+// a few thousand words of varying length and shared prefixes, sorted
+std::vector<std::string> make_words() {
+    std::vector<std::string> words;
+    unsigned int state = 12345;
+    for (int i = 0; i < 5000; i++) {
+        std::string word;
+        state = state * 1103515245 + 12345;
+        unsigned int length = 1 + (state >> 16) % 10;
+        for (unsigned int j = 0; j < length; j++) {
+            state = state * 1103515245 + 12345;
+            word += static_cast<char>('a' + (state >> 16) % 6);
+        }
+        words.push_back(word);
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    return words;
+}
+
+std::vector<unsigned char> build(std::vector<std::string> const& words, unsigned int node_size, unsigned int version) {
+    std::stringstream input;
+    for (auto const& word : words) {
+        input << word << "\n";
+    }
+    std::vector<unsigned char> output;
+    if (!build_compact_dawg_from_stream(&input, &output, false, node_size, version)) {
+        throw std::runtime_error("could not build the dawg");
+    }
+    return output;
+}
+
+std::size_t expected_lower_bound(std::vector<std::string> const& words, std::string const& key) {
+    return static_cast<std::size_t>(std::lower_bound(words.begin(), words.end(), key) - words.begin());
+}
+
+// Looks up every `stride`-th word, starting from `first`, and the keys
+// around it.
+void check_lookups(dawgcache::CompactDawgView const& view, std::vector<std::string> const& words, std::string const& label, std::size_t first, std::size_t stride) {
+    for (std::size_t i = first; i < words.size(); i += stride) {
+        std::string const& word = words[i];
+        std::string missing = word + "z";
+        check(view.lookup(word), label, "finds " + word);
+        check(view.lookup_prefix(word.substr(0, (word.size() + 1) / 2)), label, "finds a prefix of " + word);
+        check(!view.lookup(missing) && !view.lookup_prefix(missing), label, "doesn't find " + missing);
+
+        if (!view.has_counts()) continue;
+
+        dawgcache::CountedLookup result = view.lookup_counts(word);
+        check(result.found && result.final && result.index == i, label, "counts " + word);
+
+        std::string prefix = word.substr(0, (word.size() + 1) / 2);
+        std::size_t prefix_index = expected_lower_bound(words, prefix);
+        std::size_t prefix_end = expected_lower_bound(words, prefix + "\x7f");
+        result = view.lookup_counts(prefix);
+        check(result.found && result.index == prefix_index && result.suffix_count == prefix_end - prefix_index, label, "counts the prefix " + prefix);
+
+        std::string at;
+        check(view.word_at(i, &at) && at == word, label, "finds the word at " + std::to_string(i));
+        check(view.lower_bound(missing.data(), missing.size()) == expected_lower_bound(words, missing), label, "lower bound of " + missing);
+    }
+}
+
+void check_view(std::vector<std::string> const& words, unsigned int node_size, unsigned int version) {
+    std::string label = "version " + std::to_string(version) + ", node size " + std::to_string(node_size);
+    std::vector<unsigned char> buffer = build(words, node_size, version);
+    dawgcache::CompactDawgView view(buffer.data(), buffer.size());
+
+    check(view.verify(), label, "verifies");
+    check(view.version() == version, label, "reads the version");
+    check(view.has_counts() == (node_size != EDGE_COUNT_ONLY), label, "reads whether it has counts");
+
+    check_lookups(view, words, label, 0, 1);
+
+    std::vector<std::string> all;
+    view.for_each([&](std::string const& word) {
+        all.push_back(word);
+        return true;
+    });
+    check(all == words, label, "iterates over every word");
+
+    std::vector<std::string> prefixed;
+    view.for_each("ab", 2, [&](std::string const& word) {
+        prefixed.push_back(word);
+        return true;
+    });
+    std::vector<std::string> expected(words.begin() + static_cast<std::ptrdiff_t>(expected_lower_bound(words, "ab")),
+                                      words.begin() + static_cast<std::ptrdiff_t>(expected_lower_bound(words, "ac")));
+    check(prefixed == expected, label, "iterates over the words with a prefix");
+
+    std::size_t visited = 0;
+    view.for_each([&](std::string const&) { return ++visited < 3; });
+    check(visited == 3, label, "stops iterating when asked to");
+
+    if (view.has_counts()) {
+        check(view.size() == words.size(), label, "counts the words");
+        std::string at;
+        check(!view.word_at(words.size(), &at), label, "has no word past the end");
+    } else {
+        bool threw = false;
+        try {
+            view.size();
+        } catch (std::logic_error const&) {
+            threw = true;
+        }
+        check(threw, label, "needs counts to count the words");
+    }
+
+    // one view, shared by several threads each looking up its share
+    const std::size_t thread_count = 8;
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t]() { check_lookups(view, words, label + ", thread " + std::to_string(t), t, thread_count); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<unsigned char> corrupt = buffer;
+    corrupt.back() ^= 1;
+    check(!dawgcache::CompactDawgView(corrupt.data(), corrupt.size()).verify(), label, "fails to verify when corrupt");
+}
+
+void check_rejected(std::vector<unsigned char> const& buffer, std::size_t length, std::string const& message) {
+    bool threw = false;
+    try {
+        dawgcache::CompactDawgView view(buffer.data(), length);
+    } catch (std::invalid_argument const&) {
+        threw = true;
+    }
+    check(threw, "bad buffers", message);
+}
+
+} // namespace
+
+int main() {
+    std::vector<std::string> words = make_words();
+    for (unsigned int version = DAWG_VERSION_INTERLEAVED_EDGES; version <= DAWG_VERSION_TAILS; version++) {
+        for (unsigned int node_size : {EDGE_COUNT_ONLY, INCLUDES_ENTRY_COUNT, INCLUDES_EDGE_RANKS}) {
+            check_view(words, node_size, version);
+        }
+    }
+
+    std::vector<unsigned char> buffer = build(words, INCLUDES_ENTRY_COUNT, DAWG_VERSION_TAILS);
+    check_rejected(buffer, DAWG_HEADER_SIZE - 1, "rejects a buffer shorter than a header");
+    check_rejected(buffer, buffer.size() - 1, "rejects a truncated buffer");
+    std::vector<unsigned char> bad_magic = buffer;
+    bad_magic[0] = 'x';
+    check_rejected(bad_magic, bad_magic.size(), "rejects a bad magic number");
+    std::vector<unsigned char> bad_version = buffer;
+    bad_version[4] = 99;
+    check_rejected(bad_version, bad_version.size(), "rejects an unsupported version");
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "ok - dawgcache\n";
+    return 0;
+}